@@ -0,0 +1,81 @@
+#ifndef ASSET_REGISTRY_H_INCLUDDED
+#define ASSET_REGISTRY_H_INCLUDDED
+
+#include "obj_parser.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+
+namespace RTR
+{
+    // (immutable once loaded: shared by any number of renderers and threads)
+    using model_ptr = std::shared_ptr<const obj_model>;
+
+
+
+    // Meshes and textures loaded once and handed out as shared handles
+    // to whoever asks for the same file with the same contents: an asset
+    // is known by its path and a hash of the file, so a file changed on
+    // disk is loaded again while the handles to the old contents stay
+    // valid. The registry only keeps weak references, an asset goes
+    // when its last handle does (model_cache keeps them loaded).
+    // An asset asked for while it is being loaded is waited for,
+    // not loaded twice; different assets load in parallel.
+    class asset_registry
+    {
+        public:
+            asset_registry() = default;
+
+            asset_registry( const asset_registry&)            = delete;
+            asset_registry& operator=( const asset_registry&) = delete;
+
+            // the one of the process
+            static asset_registry& shared();
+
+            // the mesh and its <name>_diffuse.tga, if any,
+            // throws what loading them threw
+            model_ptr   model( const std::filesystem::path& path);
+
+            // throws tga_image::no_file if there is no such file
+            texture_ptr texture( const std::filesystem::path& path);
+
+            // FNV-1a of the contents (0: the file can't be read)
+            static uint64_t content_hash( const std::filesystem::path& path);
+
+        private:
+            template <class T>
+            struct slot
+            {
+                std::weak_ptr<const T>                          asset;
+                std::shared_future<std::shared_ptr<const T>>    loading;    // (until loaded)
+            };
+
+            // the hash of a file is computed again only if it looks changed
+            struct file_stamp
+            {
+                uintmax_t                       size = 0;
+                std::filesystem::file_time_type mtime;
+                uint64_t                        hash = 0;
+            };
+
+            std::mutex m;
+            std::unordered_map<std::string, slot<obj_model>>   models;     // by path and hashes
+            std::unordered_map<std::string, slot<tga_image>>   textures;   // ...
+            std::unordered_map<std::string, file_stamp>        stamps;     // by path
+
+            uint64_t file_hash( const std::filesystem::path& path);
+
+            template <class T, class Load>
+            std::shared_ptr<const T> acquire( std::unordered_map<std::string, slot<T>>& slots,
+                                              const std::string& key, Load load);
+    };
+}
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef FRAME_RING_H_INCLUDDED
+#define FRAME_RING_H_INCLUDDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+
+
+namespace RTR
+{
+    // Completed frames published into POSIX shared memory for other
+    // processes: a header, then <slots> slots written in turn.
+    // Every slot is a seqlock: its sequence is odd while the renderer
+    // writes it, a reader uses the pixels in place and checks that
+    // the sequence did not change meanwhile. The renderer never waits
+    // for a reader, a frame overwritten before any reader marked it read
+    // counts as dropped.
+    const char       FRAME_RING_MAGIC[8]  = { 'R', 'T', 'R', 'R', 'I', 'N', 'G', '1' };
+    const uint32_t   FRAME_RING_VERSION   = 1;
+
+    const uint32_t   FRAME_FORMAT_RGB888  = 1;  // 0x00RRGGBB (A in the top byte)
+    const uint32_t   FRAME_DEPTH_NONE     = 0;
+    const uint32_t   FRAME_DEPTH_INT8     = 1;  // larger is closer, -128 empty
+
+    struct frame_ring_header
+    {
+        char                    magic[8];
+        uint32_t                version;
+        uint32_t                slots;
+        uint64_t                slot_bytes;     // its header included
+        uint32_t                max_width;
+        uint32_t                max_height;
+        std::atomic<uint64_t>   published;      // the newest is published - 1
+        std::atomic<uint64_t>   dropped;        // overwritten, never read
+    };
+
+    struct frame_ring_slot
+    {
+        std::atomic<uint32_t>   seq;            // odd while written
+        uint32_t                format;         // FRAME_FORMAT_*
+        uint32_t                depth_format;   // FRAME_DEPTH_*
+        uint32_t                width;
+        uint32_t                height;
+        uint32_t                stride;         // pixels from a row to the next
+        uint64_t                frame;
+        std::atomic<uint64_t>   read;           // frame + 1 once a reader saw it
+
+        // the pixels follow at FRAME_RING_DATA, then the depths
+        // (height rows of <stride> each)
+    };
+
+    const size_t FRAME_RING_DATA = 64;  // bytes from a slot to its pixels
+    static_assert( sizeof( frame_ring_slot) <= FRAME_RING_DATA);
+
+
+
+    // The renderer side: creates (or replaces) the shared memory object
+    // <name>, removes it when destroyed
+    class frame_ring
+    {
+        public:
+            frame_ring( const std::string& name, int max_width, int max_height,
+                        size_t slots, bool depths);
+            ~frame_ring();
+
+            frame_ring( const frame_ring&)            = delete;
+            frame_ring& operator=( const frame_ring&) = delete;
+
+            // the top left width x height of the buffers,
+            // rows of <stride> pixels (and depths, if the ring keeps them)
+            void publish( const uint32_t* pixels, const int8_t* depths,
+                          int width, int height, int stride);
+
+            uint64_t published() const { return header->published; }
+            uint64_t dropped()   const { return header->dropped; }
+
+        private:
+            std::string             name;
+            size_t                  bytes   = 0;
+            frame_ring_header*      header  = nullptr;
+            bool                    depths  = false;
+
+            frame_ring_slot*        slot( size_t i);
+    };
+
+
+
+    // A consumer: maps the ring of a renderer that is running
+    class frame_ring_reader
+    {
+        public:
+            using visitor = std::function<void( const frame_ring_slot& slot,
+                                                const uint32_t* pixels,
+                                                const int8_t* depths)>;
+
+            explicit frame_ring_reader( const std::string& name);
+            ~frame_ring_reader();
+
+            frame_ring_reader( const frame_ring_reader&)            = delete;
+            frame_ring_reader& operator=( const frame_ring_reader&) = delete;
+
+            // hands the newest frame to <use> in place (depths: nullptr
+            // if none), false if there is none yet, if it doesn't fit its
+            // slot (torn while read, <use> isn't called) or if it was
+            // overwritten meanwhile: whatever <use> saw then is garbage
+            bool read_latest( const visitor& use);
+
+            const frame_ring_header& info() const { return *header; }
+
+        private:
+            size_t                  bytes   = 0;
+            frame_ring_header*      header  = nullptr;
+
+            frame_ring_slot*        slot( size_t i);
+    };
+}
+
+#endif
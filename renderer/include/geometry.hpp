@@ -244,6 +244,18 @@ struct quaternion
     y /= n;
     z /= n;
   }
+
+  // the same rotation k times (unit quaternions, k may be fractional)
+  quaternion<T> pow(double k) const
+  {
+    double half = std::acos(w < -1 ? -1 : (w > 1 ? 1 : w));
+    double s = std::sin(half);
+    if(s == 0)
+      return *this;
+
+    double f = std::sin(half * k) / s;
+    return quaternion<T>{std::cos(half * k), x * f, y * f, z * f};
+  }
 };
 
 
@@ -0,0 +1,81 @@
+#ifndef IMAGE_WRITER_H_INCLUDDED
+#define IMAGE_WRITER_H_INCLUDDED
+
+#include "scheduler.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+
+namespace RTR
+{
+    const int    PNG_LEVEL      = 3;    // zlib level, speed before size
+    const int    PNG_STRIP_ROWS = 32;   // rows deflated by one task
+
+
+    // Images of RGB888 frames: binary PPM, QOI or PNG.
+    // A frame is encoded into buffers kept from one image to the next,
+    // then the pieces are written through one large stdio buffer.
+    // PNG rows are filtered, then deflated in strips on the workers:
+    // a strip starts from the 32 KiB before it as its dictionary and ends
+    // on a sync flush, so the strips join into one zlib stream.
+    class image_writer
+    {
+        public:
+            enum format_t { PPM, QOI, PNG };
+
+            // (without workers PNG strips are deflated one after another)
+            explicit image_writer( format_t format, scheduler* workers = nullptr);
+
+            image_writer( const image_writer&)            = delete;
+            image_writer& operator=( const image_writer&) = delete;
+
+            // the top left width x height of the pixels,
+            // rows of <stride> pixels
+            void write( const std::string& path, const uint32_t* pixels,
+                        int width, int height, int stride);
+
+            // ... into <out> instead of a file (write_ms(): the copy)
+            void encode( const uint32_t* pixels, int width, int height,
+                         int stride, std::vector<uint8_t>& out);
+
+            const char* extension() const;     // "ppm", ...
+
+            // of the last image
+            double encode_ms() const { return encoded_ms; }
+            double write_ms()  const { return written_ms; }
+
+        private:
+            struct strip
+            {
+                std::vector<uint8_t>    data;       // deflated
+                unsigned long           adler = 1;  // of the filtered rows
+                unsigned long           crc   = 0;  // of <data>
+            };
+
+            format_t                format;
+            scheduler*              workers;
+
+            std::vector<uint8_t>    head;       // the file up to the pixels
+            std::vector<uint8_t>    body;       // QOI / PPM data, filtered PNG rows
+            std::vector<uint8_t>    tail;       // whatever follows
+            std::vector<strip>      strips;
+
+            double                  encoded_ms = 0;
+            double                  written_ms = 0;
+
+            void encode_image( const uint32_t* pixels, int width, int height, int stride);
+            void encode_ppm( const uint32_t* pixels, int width, int height, int stride);
+            void encode_qoi( const uint32_t* pixels, int width, int height, int stride);
+            void encode_png( const uint32_t* pixels, int width, int height, int stride);
+
+            void filter_rows( const uint32_t* pixels, int width, int stride,
+                              size_t y0, size_t y1);
+            void deflate_strip( size_t k, size_t row_bytes, size_t height);
+    };
+}
+
+#endif
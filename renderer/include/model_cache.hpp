@@ -0,0 +1,68 @@
+#ifndef MODEL_CACHE_H_INCLUDDED
+#define MODEL_CACHE_H_INCLUDDED
+
+#include "asset_registry.hpp"
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+
+namespace RTR
+{
+    // Models of an asset_registry kept loaded between the requests
+    // for them: the least recently used ones are dropped once all of
+    // them take more than the memory budget. A dropped model lives on
+    // until the renderers drawing it let go, only the cache forgets it.
+    // A file changed on disk is loaded again when next asked for.
+    class model_cache
+    {
+        public:
+            using model_ptr = RTR::model_ptr;
+
+            struct counters
+            {
+                size_t hits     = 0;    // found loaded
+                size_t misses   = 0;    // not kept (loaded, unless still in use)
+                size_t models   = 0;    // kept now
+                size_t bytes    = 0;    // ... their obj_model::bytes()
+                size_t budget   = 0;
+            };
+
+            explicit model_cache( size_t budget,
+                                  asset_registry& assets = asset_registry::shared());
+
+            model_cache( const model_cache&)            = delete;
+            model_cache& operator=( const model_cache&) = delete;
+
+            // throws what loading the model threw
+            model_ptr get( const std::string& path);
+
+            counters stats() const;
+
+        private:
+            struct entry
+            {
+                model_ptr                           model;
+                size_t                              bytes  = 0;
+                std::list<std::string>::iterator    lru;
+            };
+
+            size_t                  budget;
+            asset_registry&         assets;
+            mutable std::mutex      m;
+            std::unordered_map<std::string, entry> entries;
+            std::list<std::string>  lru;        // most recent first
+            size_t                  bytes  = 0;
+            size_t                  hits   = 0;
+            size_t                  misses = 0;
+
+            void evict();   // m held
+    };
+}
+
+#endif
@@ -6,18 +6,48 @@
 #include <string>
 #include <string_view>
 #include <vector>
-
-#include <SDL.h>
-#include <SDL_image.h>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
 
 #include "geometry.hpp"
+#include "simplify.hpp"
+
+
+
+namespace RTR
+{
+  // A texel (8 bits a channel, as stored in a texture)
+  struct color
+  {
+    uint8_t r = 0;
+    uint8_t g = 0;
+    uint8_t b = 0;
+    uint8_t a = 255;
+  };
+}
 
 
 
+// An immutable texture decoded from a .tga file (true-color or
+// grayscale, raw or RLE), shared between the models using it
 class tga_image
 {
 private:
-  SDL_Surface *image = nullptr;
+  size_t w = 0;
+  size_t h = 0;
+  std::vector<RTR::color> pixels;    // top row first
+
+  static uint8_t next_byte(std::istream& is)
+  {
+    int c = is.get();
+    if(c == std::char_traits<char>::eof())
+      throw std::runtime_error("truncated tga file");
+    return static_cast<uint8_t>(c);
+  }
 
 public:
   tga_image() {}
@@ -27,75 +57,87 @@ public:
     read_tga(filename);
   }
 
-  ~tga_image()
-  {
-    if(image != nullptr)
-      SDL_FreeSurface(image);
-  }
+  inline size_t width() const noexcept { return w; }
+  inline size_t height() const noexcept { return h; }
 
-  inline size_t width() const noexcept { return image->w; }
-  inline size_t height() const noexcept { return image->h; }
+  bool loaded() const noexcept { return !pixels.empty(); }
+  size_t bytes() const noexcept { return pixels.capacity() * sizeof(RTR::color); }
 
   void read_tga(const std::filesystem::path &filename)
   {
-    if(image != nullptr)
-      SDL_FreeSurface(image);
-
-    SDL_RWops *rwop;
-    rwop = SDL_RWFromFile(filename.c_str(), "rb");
-    if (rwop == nullptr)
-        throw no_file();
+    std::ifstream ifs(filename, std::ios::binary);
+    if(!ifs)
+      throw no_file();
 
-    image = IMG_LoadTGA_RW(rwop);   
-    SDL_RWclose(rwop);
-    if(!image)
+    uint8_t header[18];
+    if(!ifs.read(reinterpret_cast<char*>(header), sizeof(header)))
       throw std::runtime_error(std::string("can't open ").append(filename));
+
+    size_t id_length   = header[0];
+    size_t map_length  = header[5] | header[6] << 8;
+    size_t map_bpp     = header[7];
+    uint8_t type       = header[2];
+    size_t bpp         = header[16] / 8;
+    bool top_first     = header[17] & 0x20;
+    bool right_first   = header[17] & 0x10;
+    w = header[12] | header[13] << 8;
+    h = header[14] | header[15] << 8;
+
+    // (color-mapped and 16 bit images are not supported)
+    bool gray = (type == 3) or (type == 11);
+    bool rle  = (type == 10) or (type == 11);
+    if((type != 2 and type != 3 and !rle) or (header[1] != 0) or
+       (gray ? bpp != 1 : (bpp != 3 and bpp != 4)) or (w == 0) or (h == 0))
+      throw std::runtime_error(std::string("unsupported tga format in ").append(filename));
+
+    // (a color map is skipped along with the id)
+    ifs.ignore(id_length + map_length * ((map_bpp + 7) / 8));
+
+    pixels.assign(w * h, RTR::color{});
+    uint8_t px[4] = {};
+    size_t run = 0;         // pixels left in the current RLE packet
+    bool repeat = false;    // ... all of them px
+    for(size_t i = 0; i < w * h; ++i)
+    {
+      if(rle and (run == 0))
+      {
+        uint8_t packet = next_byte(ifs);
+        run = (packet & 0x7F) + 1;
+        repeat = packet & 0x80;
+        if(repeat)
+          for(size_t k = 0; k < bpp; ++k)
+            px[k] = next_byte(ifs);
+      }
+
+      if(!repeat)
+        for(size_t k = 0; k < bpp; ++k)
+          px[k] = next_byte(ifs);
+      run -= rle;
+
+      size_t x = i % w;
+      size_t y = i / w;
+      if(right_first)
+        x = w - 1 - x;
+      if(!top_first)
+        y = h - 1 - y;
+
+      // (stored as BGR(A))
+      pixels[y * w + x] = gray ? RTR::color{px[0], px[0], px[0], 255}
+                               : RTR::color{px[2], px[1], px[0], 255};
+    }
   }
 
-  SDL_Color pixel_color(int x, int y) const
+  // v = 0 (y = 0) is the bottom edge of the image
+  RTR::color pixel_color(int x, int y) const
   {
-    size_t w = width();
-    size_t h = height();
-
     if((x < 0) || (static_cast<size_t>(x) >= w) ||
        (y < 0) || (static_cast<size_t>(y) >= h))
     {
       throw std::out_of_range("searching for a pixel out of surface");
     }
 
-    y = static_cast<size_t>(h) - y;
-    int bpp = image->format->BytesPerPixel;
-    Uint8 *ptr = static_cast<Uint8*>(image->pixels) + y * image->pitch + x * bpp;
-
-    Uint32 p;
-    switch (bpp)
-    {
-      case 1:
-        p = *ptr;
-        break;
-
-      case 2:
-        p = *reinterpret_cast<Uint16*>(ptr);
-        break;
-
-      case 3:
-        if (SDL_BYTEORDER == SDL_BIG_ENDIAN)
-          p = (ptr[0] << 16 | ptr[1] << 8 | ptr[2]);
-        else
-          p = (ptr[0] | ptr[1] << 8 | ptr[2] << 16);
-        break;
-
-      case 4:
-        p = *reinterpret_cast<Uint32*>(ptr);
-        break;
-
-      default:
-        throw std::runtime_error("unknown pixel format : strange bpp");
-    }
-
-    SDL_Color rgb;
-    SDL_GetRGB(p, image->format, &rgb.r, &rgb.g, &rgb.b);
-    return rgb;
+    size_t row = std::min(h - y, h - 1);
+    return pixels[row * w + x];
   }
   
   
@@ -107,8 +149,52 @@ public:
     };
 };
 
+// (immutable once loaded: shared by any number of models and threads)
+using texture_ptr = std::shared_ptr<const tga_image>;
+
+
+
+
+
+
+// A group of nearby faces culled as a whole
+// (bounding sphere and normal cone in model space)
+struct mesh_cluster
+{
+  size_t first = 0;           // range in obj_model::cluster_faces
+  size_t count = 0;
+
+  vec3d  center;
+  double radius = 0;
+
+  vec3d  cone_axis;
+  double cone_cutoff = 2;     // sin of the cone half-angle, > 1 if no cone
+};
+
+const size_t CLUSTER_SIZE    = 64;   // max faces per cluster
+const double CLUSTER_MIN_COS = 0.5;  // max spread of normals from the seed
+
 
 
+// One level of detail: faces refer to the vertices of the source mesh
+struct mesh_lod
+{
+  std::vector<std::vector<vec3i>> faces;
+
+  std::vector<mesh_cluster> clusters;
+  std::vector<uint32_t> cluster_faces;
+
+  // every edge once, as 3 * face + corner: it goes from the corner
+  // to the next one of that face (in the order of the faces),
+  // the twin is the same edge in a second face (or the edge itself)
+  std::vector<uint32_t> edges;
+  std::vector<uint32_t> edge_twins;
+
+  double error = 0;   // distance to the source surface (model units)
+};
+
+const size_t LOD_MIN_FACES = 256;   // the chain stops here
+const double LOD_MIN_RATIO = 0.9;   // ... or when a level saves too little
 
 
 
@@ -116,20 +202,247 @@ class obj_model
 {
 private:
   std::vector<vec3d> vertices;
-  std::vector<std::vector<vec3i>> faces;
+  std::vector<mesh_lod> lods = std::vector<mesh_lod>(1);   // [0] is the source
 
-  double max_x;
-  double min_x;
-  double max_y;
-  double min_y;
-  double max_z;
-  double min_z;
+  double max_x = std::numeric_limits<double>::lowest();
+  double min_x = std::numeric_limits<double>::max();
+  double max_y = std::numeric_limits<double>::lowest();
+  double min_y = std::numeric_limits<double>::max();
+  double max_z = std::numeric_limits<double>::lowest();
+  double min_z = std::numeric_limits<double>::max();
 
   std::vector<vec2d> texture_verts;
-  tga_image diffuse;
+  texture_ptr diffuse;                // shared with other models
 
-public:
-  obj_model(std::filesystem::path file_path)
+
+
+  // interleaves the lower 10 bits of x, y and z
+  static uint32_t morton3(uint32_t x, uint32_t y, uint32_t z)
+  {
+    auto spread = [](uint32_t v)
+    {
+      v &= 0x3FF;
+      v = (v | (v << 16)) & 0x030000FF;
+      v = (v | (v << 8))  & 0x0300F00F;
+      v = (v | (v << 4))  & 0x030C30C3;
+      v = (v | (v << 2))  & 0x09249249;
+      return v;
+    };
+    return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+  }
+
+  // clusters are grown from seeds taken along a Morton curve of the face
+  // centroids over faces sharing a vertex, a face joins a cluster only
+  // if its normal is close to the one of the seed (keeps the cones narrow)
+  void build_clusters(size_t lod)
+  {
+    auto& faces         = lods[lod].faces;
+    auto& clusters      = lods[lod].clusters;
+    auto& cluster_faces = lods[lod].cluster_faces;
+
+    size_t n = faces.size();
+    if(n == 0)
+      return;
+
+    std::vector<vec3d> centroids(n);
+    vec3d lo = vertices[faces[0][0][0]];
+    vec3d hi = lo;
+    for(size_t i = 0; i < n; ++i)
+    {
+      for(size_t k = 0; k < 3; ++k)
+        centroids[i] = centroids[i] + vertices[faces[i][k][0]] * (1. / 3);
+      for(size_t k = 0; k < 3; ++k)
+      {
+        lo[k] = std::min(lo[k], centroids[i][k]);
+        hi[k] = std::max(hi[k], centroids[i][k]);
+      }
+    }
+
+    std::vector<uint32_t> codes(n);
+    for(size_t i = 0; i < n; ++i)
+    {
+      uint32_t q[3];
+      for(size_t k = 0; k < 3; ++k)
+      {
+        double extent = hi[k] - lo[k];
+        q[k] = extent > 0 ? (centroids[i][k] - lo[k]) / extent * 1023 : 0;
+      }
+      codes[i] = morton3(q[0], q[1], q[2]);
+    }
+
+    std::vector<uint32_t> seeds(n);
+    std::iota(seeds.begin(), seeds.end(), 0);
+    std::stable_sort(seeds.begin(), seeds.end(),
+                     [&](uint32_t a, uint32_t b) { return codes[a] < codes[b]; });
+
+
+    // faces around every vertex
+    std::vector<uint32_t> vf_first(vertices.size() + 1, 0);
+    for(auto& f : faces)
+      for(size_t k = 0; k < 3; ++k)
+        vf_first[f[k][0] + 1]++;
+    std::partial_sum(vf_first.begin(), vf_first.end(), vf_first.begin());
+
+    std::vector<uint32_t> vf(vf_first.back());
+    std::vector<uint32_t> fill(vf_first.begin(), vf_first.end() - 1);
+    for(size_t i = 0; i < n; ++i)
+      for(size_t k = 0; k < 3; ++k)
+        vf[fill[faces[i][k][0]]++] = i;
+
+
+    std::vector<bool> taken(n, false);
+    cluster_faces.clear();
+    cluster_faces.reserve(n);
+    std::vector<size_t> bounds;
+
+    for(uint32_t seed : seeds)
+    {
+      if(taken[seed])
+        continue;
+
+      size_t first = cluster_faces.size();
+      bounds.push_back(first);
+      vec3d seed_normal = face_normal(seed, lod);
+
+      taken[seed] = true;
+      cluster_faces.push_back(seed);
+      for(size_t q = first; q < cluster_faces.size(); ++q)
+        for(size_t k = 0; k < 3; ++k)
+        {
+          size_t v = faces[cluster_faces[q]][k][0];
+          for(size_t a = vf_first[v]; a < vf_first[v + 1]; ++a)
+          {
+            uint32_t f = vf[a];
+            if(taken[f] or (cluster_faces.size() - first >= CLUSTER_SIZE))
+              continue;
+            if(face_normal(f, lod) * seed_normal < CLUSTER_MIN_COS)
+              continue;
+
+            taken[f] = true;
+            cluster_faces.push_back(f);
+          }
+        }
+    }
+    bounds.push_back(n);
+
+
+    for(size_t b = 0; b + 1 < bounds.size(); ++b)
+    {
+      mesh_cluster c;
+      c.first = bounds[b];
+      c.count = bounds[b + 1] - bounds[b];
+      size_t first = c.first;
+
+      vec3d clo = vertices[faces[cluster_faces[first]][0][0]];
+      vec3d chi = clo;
+      vec3d axis;
+      for(size_t f = first; f < first + c.count; ++f)
+      {
+        for(size_t k = 0; k < 3; ++k)
+        {
+          const vec3d& v = vertices[faces[cluster_faces[f]][k][0]];
+          for(size_t a = 0; a < 3; ++a)
+          {
+            clo[a] = std::min(clo[a], v[a]);
+            chi[a] = std::max(chi[a], v[a]);
+          }
+        }
+        axis = axis + face_normal(cluster_faces[f], lod);
+      }
+
+      c.center = (clo + chi) * 0.5;
+      for(size_t f = first; f < first + c.count; ++f)
+        for(size_t k = 0; k < 3; ++k)
+          c.radius = std::max(c.radius,
+                              (vertices[faces[cluster_faces[f]][k][0]] - c.center).norm());
+
+      // the cone is kept only if all the normals fit in a half-space
+      if(axis.norm() > 0)
+      {
+        c.cone_axis = axis.normalize();
+        double mindp = 1;
+        for(size_t f = first; f < first + c.count; ++f)
+        {
+          vec3d nf = face_normal(cluster_faces[f], lod);
+          if(nf.norm() > 0)
+            mindp = std::min(mindp, nf * c.cone_axis);
+        }
+        if(mindp > 0)
+          c.cone_cutoff = std::sqrt(1 - mindp * mindp);
+      }
+
+      clusters.push_back(c);
+    }
+  }
+
+
+
+  // the edges shared by several faces are kept for the first one
+  // (and the second one as the twin, the others are dropped)
+  void build_edges(size_t lod)
+  {
+    auto& faces = lods[lod].faces;
+    auto& edges = lods[lod].edges;
+    auto& twins = lods[lod].edge_twins;
+
+    // (vertex pair, lower index first -> edge)
+    std::vector<std::pair<uint64_t, uint32_t>> keys;
+    keys.reserve(faces.size() * 3);
+    for(size_t f = 0; f < faces.size(); ++f)
+      for(size_t c = 0; c < 3; ++c)
+      {
+        uint64_t a = faces[f][c][0];
+        uint64_t b = faces[f][(c + 1) % 3][0];
+        keys.emplace_back(std::min(a, b) << 32 | std::max(a, b), 3 * f + c);
+      }
+
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<std::pair<uint32_t, uint32_t>> unique;
+    for(size_t k = 0; k < keys.size(); ++k)
+      if((k == 0) or (keys[k].first != keys[k - 1].first))
+      {
+        bool shared = (k + 1 < keys.size()) and
+                      (keys[k + 1].first == keys[k].first);
+        unique.emplace_back(keys[k].second,
+                            keys[shared ? k + 1 : k].second);
+      }
+
+    std::sort(unique.begin(), unique.end());
+
+    edges.clear();
+    twins.clear();
+    for(auto& e : unique)
+    {
+      edges.push_back(e.first);
+      twins.push_back(e.second);
+    }
+  }
+
+
+
+  // each level halves the faces of the previous one
+  void build_lods()
+  {
+    mesh_simplifier simplifier(vertices, lods[0].faces);
+
+    while(lods.back().faces.size() > LOD_MIN_FACES)
+    {
+      size_t prev = lods.back().faces.size();
+      if(!simplifier.simplify(prev / 2) or
+         (simplifier.nfaces() > prev * LOD_MIN_RATIO))
+        break;
+
+      mesh_lod l;
+      l.faces = simplifier.faces();
+      l.error = simplifier.error();
+      lods.push_back(std::move(l));
+      build_clusters(lods.size() - 1);
+      build_edges(lods.size() - 1);
+    }
+  }
+
+  void read_obj(const std::filesystem::path& file_path)
   {
     if(file_path.has_filename() == false)
       throw std::runtime_error("Empty filename");
@@ -197,29 +510,45 @@ public:
           f.push_back(tmp);
         }
 
-        faces.push_back(f);
+        lods[0].faces.push_back(f);
       }
     }
-    
-     
-    IMG_Init(0);
+
+    build_clusters(0);
+    build_edges(0);
+    build_lods();
+  }
+
+public:
+  // the mesh and the texture next to it (<name>_diffuse.tga), if any
+  obj_model(const std::filesystem::path& file_path)
+  {
+    read_obj(file_path);
 
     try
     {
-      diffuse.read_tga(file_path.replace_extension("_diffuse.tga"));
+      diffuse = std::make_shared<const tga_image>(diffuse_path(file_path));
     }
     catch(tga_image::no_file& e)
     {
-      std::cout << "Warning: no texture found"  << std::endl;
+      std::cerr << "Warning: no texture found"  << std::endl;
     }
   }
 
+  // the mesh with a texture loaded before (nullptr: none)
+  obj_model(const std::filesystem::path& file_path, texture_ptr texture)
+  : diffuse(std::move(texture))
+  {
+    read_obj(file_path);
+  }
 
+  // (immutable once loaded, shared through model handles)
+  obj_model(const obj_model&) = delete;
+  obj_model& operator=(const obj_model&) = delete;
 
-
-  ~obj_model()
+  static std::filesystem::path diffuse_path(std::filesystem::path file_path)
   {
-    IMG_Quit();
+    return file_path.replace_filename(file_path.stem().string() + "_diffuse.tga");
   }
 
 
@@ -227,7 +556,35 @@ public:
 
   size_t nvertices() const { return vertices.size(); }
 
-  size_t nfaces() const { return faces.size(); }
+  bool has_texture() const { return diffuse != nullptr; }
+  const texture_ptr& texture() const { return diffuse; }
+
+  // heap memory held by the model, roughly
+  // (a texture shared with other models is counted by each)
+  size_t bytes() const
+  {
+    size_t res = vertices.capacity() * sizeof(vec3d) +
+                 texture_verts.capacity() * sizeof(vec2d) +
+                 (diffuse ? diffuse->bytes() : 0);
+
+    for(auto& l : lods)
+    {
+      res += l.faces.capacity() * sizeof(std::vector<vec3i>);
+      for(auto& f : l.faces)
+        res += f.capacity() * sizeof(vec3i);
+
+      res += l.clusters.capacity() * sizeof(mesh_cluster) +
+             (l.cluster_faces.capacity() + l.edges.capacity() +
+              l.edge_twins.capacity()) * sizeof(uint32_t);
+    }
+
+    return res;
+  }
+
+  size_t nfaces(size_t lod = 0) const { return lods[lod].faces.size(); }
+
+  size_t nlods() const { return lods.size(); }
+  double lod_error(size_t lod) const { return lods[lod].error; }
 
   double xshift() const { return (max_x + min_x) / 2; }
   double yshift() const { return (max_y + min_y) / 2; }
@@ -236,6 +593,7 @@ public:
 
   double xborder() const { return (max_x - min_x) / 2; }
   double yborder() const { return (max_y - min_y) / 2; }
+  double zborder() const { return (max_z - min_z) / 2; }
 
   double max() const
   {
@@ -244,32 +602,56 @@ public:
     return std::max(x, y);
   }
 
+  // outward unit normal of a face (zero if the face is degenerate)
+  vec3d face_normal(size_t i, size_t lod = 0) const
+  {
+    const auto& f = lods[lod].faces[i];
+    const vec3d& v0 = vertices[f[0][0]];
+    vec3d n = (vertices[f[1][0]] - v0) ^ (vertices[f[2][0]] - v0);
+    return n.norm() > 0 ? n.normalize() : vec3d();
+  }
+
+  const std::vector<mesh_cluster>& face_clusters(size_t lod = 0) const
+  { return lods[lod].clusters; }
+
+  uint32_t cluster_face(size_t i, size_t lod = 0) const
+  { return lods[lod].cluster_faces[i]; }
+
+  const std::vector<uint32_t>& face_edges(size_t lod = 0) const
+  { return lods[lod].edges; }
+
+  const std::vector<uint32_t>& face_edge_twins(size_t lod = 0) const
+  { return lods[lod].edge_twins; }
+
+  size_t diffuse_width() const { return diffuse->width(); }
+  size_t diffuse_height() const { return diffuse->height(); }
+
   vec3d vertice(size_t i) const { return vertices[i]; }
 
-  std::vector<int> face(size_t i)
+  std::vector<int> face(size_t i, size_t lod = 0) const
   {
     std::vector<int> res;
-    for(auto& elem : faces[i])
+    for(auto& elem : lods[lod].faces[i])
       res.push_back(elem[0]);
     return res;
   }
 
-  vec2i tv(size_t nface, size_t nvert)
+  vec2i tv(size_t nface, size_t nvert, size_t lod = 0) const
   {
-    size_t i = faces[nface][nvert][1];
-    return vec2i(texture_verts[i].x * diffuse.width(),
-                 texture_verts[i].y * diffuse.height());
+    size_t i = lods[lod].faces[nface][nvert][1];
+    return vec2i(texture_verts[i].x * diffuse->width(),
+                 texture_verts[i].y * diffuse->height());
   }
 
-  SDL_Color tv_clr(size_t nface, size_t nvert)
+  RTR::color tv_clr(size_t nface, size_t nvert) const
   {
     vec2i t = tv(nface, nvert);
-    return diffuse.pixel_color(t.x, t.y);
+    return diffuse->pixel_color(t.x, t.y);
   }
 
-  SDL_Color tv_clr(int x, int y)
+  RTR::color tv_clr(int x, int y) const
   {
-    return diffuse.pixel_color(x, y);
+    return diffuse->pixel_color(x, y);
   }
 };
 
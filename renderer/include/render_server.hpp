@@ -0,0 +1,148 @@
+#ifndef RENDER_SERVER_H_INCLUDDED
+#define RENDER_SERVER_H_INCLUDDED
+
+#include "renderer.hpp"
+#include "model_cache.hpp"
+#include "image_writer.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+
+namespace RTR
+{
+    const size_t SERVER_RENDERS_DEFAULT = 2;    // frames drawn at once
+    const size_t SERVER_QUEUE_DEFAULT   = 64;   // requests waiting, more are refused
+    const size_t SERVER_CACHE_DEFAULT   = 512;  // MiB of models kept loaded
+    const int    SERVER_MAX_SIDE        = 4096; // pixels of an image
+    const size_t SERVER_MAX_LINE        = 4096; // bytes of a request
+    const size_t SERVER_LATENCIES       = 1024; // kept for the percentiles
+
+
+    struct server_options
+    {
+        std::string socket_path;
+        size_t      renders     = SERVER_RENDERS_DEFAULT;
+        size_t      max_queue   = SERVER_QUEUE_DEFAULT;
+        size_t      cache_bytes = SERVER_CACHE_DEFAULT << 20;
+        bool        verbose     = false;    // a line per request
+    };
+
+
+
+    // An image asked for by a client
+    struct render_request
+    {
+        std::string             model;      // .obj path, as the server sees it
+        mode_t                  mode        = null;
+        quaterniond             orientation = ORIENTATION_DEFAULT;
+        int                     width       = 0;
+        int                     height      = 0;
+        image_writer::format_t  format      = image_writer::PNG;
+    };
+
+
+
+    // Local render service on a Unix domain socket.
+    // A client sends requests, one a line, and gets an answer to each
+    // in turn:
+    //     render <mode> <W>x<H> <ppm|qoi|png> <w> <x> <y> <z> <model path>
+    //         -> "ok <bytes>\n" and the encoded image,
+    //     stats
+    //         -> "ok <bytes>\n" and the stats() line,
+    //     anything that fails -> "error <what>\n".
+    // Requests are queued and drawn by <renders> threads, each with a
+    // Renderer of its own kept for the next request of the same model
+    // and size; the frames are split between the workers as usual.
+    // Models stay loaded in a model_cache.
+    class render_server
+    {
+        public:
+            render_server( const server_options& options, scheduler& workers);
+            ~render_server();
+
+            render_server( const render_server&)            = delete;
+            render_server& operator=( const render_server&) = delete;
+
+            // listens and answers until stop()
+            void run();
+
+            // (async-signal-safe)
+            void stop();
+
+            // queue depth, cache hit rate, latency percentiles, ...
+            std::string stats() const;
+
+            // "render ..." without the leading word, throws if malformed
+     static render_request parse_request( const std::string& args);
+
+        private:
+            struct job
+            {
+                render_request          request;
+                std::chrono::steady_clock::time_point queued;
+
+                std::vector<uint8_t>    image;
+                std::string             error;  // instead of the image
+                bool                    done = false;
+            };
+
+            // what a render thread keeps from one request to the next
+            struct render_slot
+            {
+                model_cache::model_ptr      model;
+                std::unique_ptr<Renderer>   core;
+                std::vector<uint32_t>       pixels;
+                screen_rect                 dirty;
+                std::unique_ptr<image_writer> writers[3];  // by format
+            };
+
+            struct connection
+            {
+                int                 fd = -1;
+                std::thread         thread;
+                std::atomic<bool>   finished{false};
+            };
+
+            server_options          options;
+            scheduler&              workers;
+            model_cache             cache;
+
+            int                     listen_fd   = -1;
+            int                     wake_fd[2]  = { -1, -1 };   // stop() -> run()
+
+            mutable std::mutex      m;
+            std::condition_variable queue_cv;   // a job or stopping
+            std::condition_variable done_cv;    // a job finished
+            std::deque<job*>        queue;
+            bool                    stopping    = false;
+            std::vector<std::thread> renders;
+            std::list<connection>   connections;
+
+            // (under m)
+            size_t                  queue_max   = 0;
+            size_t                  served      = 0;
+            size_t                  failed      = 0;
+            size_t                  refused     = 0;
+            std::vector<double>     latencies;  // ms, the last SERVER_LATENCIES
+            size_t                  latency_next = 0;
+
+            void render_loop();
+            void render_job( render_slot& slot, job& j);
+            void serve( connection& c);
+            std::string answer( const std::string& line,
+                                std::vector<uint8_t>& body);  // -> the first line
+            void reap_connections( bool all);
+    };
+}
+
+#endif
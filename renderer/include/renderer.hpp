@@ -0,0 +1,527 @@
+#ifndef RENDERER_H_INCLUDDED
+#define RENDERER_H_INCLUDDED
+
+#include "obj_parser.hpp"
+#include "geometry.hpp"
+#include "scheduler.hpp"
+
+#include <array>
+#include <atomic>
+#include <optional>
+#include <vector>
+#include <numeric>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <limits>
+
+
+
+namespace RTR
+{
+    const uint8_t R_BGR = 0;
+    const uint8_t G_BGR = 0;
+    const uint8_t B_BGR = 0;
+    const uint8_t A_BGR = 255;
+
+    const double PERSPECTIVE_FOCUS = -0.5;
+
+    const double W_SHIFT_DEFAULT        = 0.;  // determines .obj position
+    const double H_SHIFT_DEFAULT        = 0.;   // on the screen
+    const double D_SHIFT_DEFAULT        = -0.5;   //
+    const double OBJ_SCALE_DEFAULT      = 400.;  // determines size of the model on the screen
+    const int    OBJ_SCALE_HEIGHT       = 800;   // ... in a buffer this high
+
+    const double LOD_THRESHOLD_DEFAULT  = 1.;    // max simplification error, pixels
+
+
+    using zbuf_depth_t              = int8_t; // 16 or 8 bits
+    const int ZBUF_SCALE            = 50;
+
+    // front-to-back sort key is SORT_KEY_BIAS - (z1 + z2 + z3)
+    const int SORT_KEY_BIAS         = 3 * std::numeric_limits<zbuf_depth_t>::max();
+
+    // HIDDEN_LINE: how far behind the depths of the faces a line may be
+    // (the edge lies on them, only the rounding of the two differs)
+    const int HIDDEN_LINE_BIAS      = 2;
+
+
+    const quaterniond ORIENTATION_DEFAULT( 0, 0, 1, 0);
+
+
+    /* Parallelism */
+    const int    TILE_SIZE      = 64;   // pixels, rasterized by one task
+    const size_t CLUSTER_GRAIN  = 4;    // clusters projected by one task
+    const size_t EDGE_GRAIN     = 2048; // WIREFRAME edges drawn by one task
+
+
+    /* Resolution */
+    const double RES_SCALE_MIN  = 0.25; // of the buffer side
+    const int    RES_ALIGN      = 8;    // of the render width, pixels
+
+
+    /* Progressive refinement */
+    const size_t REFINE_SAMPLES_MAX = 256;  // fit the 16 bit sums
+
+
+    /* Temporal reprojection */
+    const double REPROJ_MAX_ANGLE   = 0.15; // radians, larger moves are redrawn
+    const double REPROJ_MAX_SHIFT   = 0.1;  // model units, ...
+    const size_t REPROJ_REFRESH     = 8;    // every tile redrawn that often
+    const int    REPROJ_HOLE_RADIUS = 4;    // pixels, wider gaps are background
+    const uint32_t WARP_NONE        = 0xffffffff;   // lands off the view
+
+
+
+
+    // Supported modes:
+        enum mode_t
+        {
+            GOLD,
+            NOT_GOLD,
+            TRIANGLE,
+            WIREFRAME,
+            RAND,
+            RAST,
+            N_RM_RST,
+            TEXTURE,
+            ZBUF,
+            VISBUF,     // depth + face id, then a full-screen shading pass
+            HIDDEN_LINE,    // depth only, then the edges in front of it
+
+            null
+        };
+
+    // the mode a model is drawn in, by its -m name ("texture", ...),
+    // null if there is no such
+    mode_t mode_by_name( const std::string& name);
+
+
+    // Color buffer pixels (SDL_PIXELFORMAT_RGB888):
+    inline uint32_t pack_color( uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+    {
+        return (uint32_t(a) << 24) | (uint32_t(r) << 16) |
+               (uint32_t(g) << 8)  |  uint32_t(b);
+    }
+
+
+
+    // Per-frame counters:
+    struct frame_stats
+    {
+        size_t depth_tests          = 0;    // pixels tested against zbuf
+        size_t depth_writes         = 0;    // pixels that passed the test
+        size_t texel_fetches        = 0;    // texture lookups actually done
+        size_t texel_fetches_saved  = 0;    // skipped thanks to the prepass
+
+        size_t lod                  = 0;    // level of detail drawn
+        size_t faces                = 0;    // ... and its faces
+
+        size_t clusters             = 0;
+        size_t clusters_culled      = 0;    // dropped before projection
+
+        double sort_ms              = 0;    // front-to-back ordering
+        double raster_ms            = 0;    // everything after it
+        double composite_ms         = 0;    // sort-last depth merge
+
+        size_t tasks                = 0;    // run by the scheduler for the frame
+        size_t steals               = 0;
+        double idle_ms              = 0;    // waiting for them, nothing to run
+
+        double res_scale            = 1;    // render / buffer side
+
+        size_t tiles                = 0;    // reprojected frame: in the view
+        size_t tiles_redrawn        = 0;    // ... and rasterized anyway
+
+        size_t bytes_cleared        = 0;    // color and depth reset
+        size_t pixel_writes         = 0;    // WIREFRAME: drawn by the edges
+    };
+
+
+
+    // A rectangle of the buffers, [x0, x1) x [y0, y1):
+    // (what a frame drew into, empty if x0 >= x1 or y0 >= y1)
+    struct screen_rect
+    {
+        int x0 = 0, y0 = 0;
+        int x1 = 0, y1 = 0;
+
+        bool empty() const
+        {
+            return (x0 >= x1) or (y0 >= y1);
+        }
+
+        size_t area() const
+        {
+            return empty() ? 0 : size_t( x1 - x0) * (y1 - y0);
+        }
+
+        void unite( const screen_rect& r)
+        {
+            if (r.empty())
+                return;
+
+            if (empty())
+            {
+                *this = r;
+                return;
+            }
+
+            x0 = std::min( x0, r.x0);
+            y0 = std::min( y0, r.y0);
+            x1 = std::max( x1, r.x1);
+            y1 = std::max( y1, r.y1);
+        }
+
+        screen_rect intersect( const screen_rect& o) const
+        {
+            screen_rect r{ std::max( x0, o.x0), std::max( y0, o.y0),
+                           std::min( x1, o.x1), std::min( y1, o.y1)};
+            return r.empty() ? screen_rect() : r;
+        }
+
+        screen_rect clip( int w, int h) const
+        {
+            return intersect( { 0, 0, w, h});
+        }
+    };
+
+
+
+    // A rectangle of the screen rasterized by a single task
+    // with its own draw color and counters:
+    // (sort-last partitions draw the whole screen into private buffers)
+    struct screen_tile
+    {
+        int x0 = 0, y0 = 0;     // [x0, x1) x [y0, y1)
+        int x1 = 0, y1 = 0;
+
+        zbuf_depth_t*   zbuf        = nullptr;  // STRIDE pixels a row
+        uint32_t*       cbuf        = nullptr;
+        uint32_t*       vbuf        = nullptr;
+
+        uint32_t        color       = 0;
+        frame_stats     stats;
+        uint32_t        epoch       = 0;    // frame its depths are cleared for
+
+        void set_draw_color( uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+        {
+            color = pack_color( r, g, b, a);
+        }
+    };
+
+
+
+    // What the input changes between frames:
+    // (the main thread edits one copy, the render thread draws another)
+    struct view_state
+    {
+        mode_t      mode            = null;
+        quaterniond orientation;
+        double      W_SHIFT         = 0;
+        double      H_SHIFT         = 0;
+        double      D_SHIFT         = 0;
+        bool        depth_prepass   = false;
+        bool        front_to_back   = false;
+        bool        backface_culling = false;
+        bool        sort_last       = false;
+        bool        progressive     = false;
+        bool        reproject       = false;
+
+        uint32_t    input_ms        = 0;    // SDL_GetTicks() of the oldest
+                                            // input drawn in this view
+    };
+
+
+
+    // Buffers of the caller a frame is drawn into: RGB888 colors and
+    // the depths (nullptr: the renderer's own), rows <stride> pixels apart;
+    // the frame takes their top left view_width() x view_height()
+    struct render_target
+    {
+        uint32_t*       color   = nullptr;
+        zbuf_depth_t*   depth   = nullptr;
+        int             stride  = 0;        // 0: the renderer's
+        screen_rect*    dirty   = nullptr;  // <color> not background, kept
+                                            // by the caller (nullptr: unknown)
+    };
+
+
+
+    // -t: a reprojected frame against the same view drawn in full
+    struct reprojection_error
+    {
+        double pixels   = 0;    // % of the view that differ
+        double mean     = 0;    // per channel, of 255
+    };
+
+
+
+    // The rendering core: draws a model into the buffers of the caller,
+    // every frame by the workers of a scheduler; no window, no events
+    class Renderer
+    {
+        const obj_model& model;
+        mode_t      mode    = null;
+
+        double W_SHIFT    = W_SHIFT_DEFAULT;   // determine .obj
+        double H_SHIFT    = H_SHIFT_DEFAULT;   // position
+        double D_SHIFT    = D_SHIFT_DEFAULT;   // position
+        double OBJ_SCALE  = OBJ_SCALE_DEFAULT; // on the screen
+
+        quaterniond  orientation = ORIENTATION_DEFAULT;
+
+        bool depth_prepass  = false;    // TEXTURE: fill zbuf, then shade
+        bool front_to_back  = false;    // sort faces by depth every frame
+        bool backface_culling = false;  // drop faces turned away from us
+        bool cull_backfaces = false;    // ... in this frame
+
+        double lod_threshold = LOD_THRESHOLD_DEFAULT;   // <= 0: source mesh only
+        size_t lod           = 0;                       // in this frame
+        frame_stats stats;
+
+        const std::atomic<bool>* cancel = nullptr;  // frame given up if set
+
+
+
+        std::vector<zbuf_depth_t>   own_zbuf;   // unless the caller has one
+        zbuf_depth_t*   zbuf     = nullptr;
+
+        uint32_t*       vbuf     = nullptr; // VISBUF: face id + 1 per pixel
+
+        // Dirty rectangles: a buffer is background (or empty depth)
+        // outside of what was drawn into it last, so only that part
+        // is cleared
+        screen_rect     zbuf_dirty;             // zbuf not empty
+        screen_rect     zbuf_stale;             // ... left by the last frame,
+                                                // the tiles clear it lazily
+        screen_rect     drawn;                  // this frame, in the view
+        std::vector<screen_rect> draw_boxes;    // ... per transform task
+        size_t          bytes_cleared  = 0;     // since the frame started
+
+        uint32_t*       cbuf     = nullptr; // color buffer drawn into
+        screen_rect*    cbuf_dirty = nullptr; // ... its part not background
+                                              // (nullptr: unknown)
+
+        // Buffers: BUF_WIDTH x BUF_HEIGHT pixels, rows STRIDE apart
+        int         BUF_WIDTH    = 0;
+        int         BUF_HEIGHT   = 0;
+        int         STRIDE       = 0;
+
+        // Resolution: frames are drawn into the top left corner
+        // of the buffers (rows stay STRIDE long)
+        int         VIEW_WIDTH   = 0;
+        int         VIEW_HEIGHT  = 0;
+        double      view_scale   = 1.;  // VIEW_WIDTH / BUF_WIDTH
+
+        // Progressive refinement: samples of the same view at subpixel
+        // offsets with filtered textures, averaged
+        bool        filter_textures = false;
+        double      jitter_x        = 0;    // subpixel offset of the sample
+        double      jitter_y        = 0;    //
+        std::vector<uint16_t> accum;        // sums of the samples, RGBA
+        screen_rect accum_rect;             // ... where any sample drew
+
+        // Temporal reprojection: the previous frame is warped
+        // to the new camera with its depths, only the tiles it leaves
+        // holes in (and a few in turn) are rasterized again
+        bool        reproject       = false;
+        bool        reproject_frame = false;    // this one is warped
+        size_t      reproj_count    = 0;        // picks the refreshed tiles
+        bool        hist_valid      = false;
+        view_state  hist_view;                  // camera of the history
+        double      hist_scale      = 1.;
+        size_t      hist_lod        = 0;
+        std::vector<zbuf_depth_t>   hist_zbuf;
+        std::vector<uint32_t>       hist_cbuf;  // face ids in VISBUF
+        std::vector<uint32_t>       warp_pos;   // history pixel -> x | y << 16
+        std::vector<zbuf_depth_t>   warp_z;     // ... and its depth now
+        std::vector<std::array<int, 4>> warp_boxes; // history tile -> where
+                                                    // it lands, x0 y0 x1 y1
+        std::vector<uint32_t>       check_buf;  // full render to compare with
+        bool        checking        = false;    // ... being drawn
+
+
+        scheduler*  workers;
+        scheduler::tally work;      // of this renderer's frames only
+        uint32_t    frame_number = 0;
+
+        std::vector<tuple_triangle3i_double_bool> projected;
+        std::vector<uint8_t>                      zbuf_shaded;
+
+        std::vector<screen_tile>            tiles;
+        std::vector<std::vector<uint32_t>>  bins;   // [chunk][tile] -> faces
+        size_t                              bin_chunks = 0;
+
+        // Sort-last: a range of faces per task, then a depth merge
+        // (parts[0] draws into the caller's buffers)
+        bool                                sort_last = false;
+        std::vector<screen_tile>            parts;
+        std::vector<std::vector<zbuf_depth_t>> part_zbuf;
+        std::vector<std::vector<uint32_t>>  part_cbuf;
+        std::vector<std::vector<uint32_t>>  part_vbuf;
+
+        std::vector<uint32_t>   vbuf_data;
+
+        std::vector<uint32_t>   draw_order;     // faces in submission order
+        std::vector<uint32_t>   sort_tmp;
+        std::vector<uint16_t>   sort_keys;
+
+        private:
+            view_state current_view() const;
+            void apply_view( const view_state& v);
+            void set_target( const render_target& target);
+            bool cancelled() const { return cancel and *cancel; }
+
+            bool reprojectable() const;
+            void save_history();
+            void warp_source( size_t tile);
+            bool warp_tile( size_t tile);
+
+            void render_mode_threaded();
+            void bin_faces( size_t chunk);
+            void render_tile( size_t tile);
+            void render_part( size_t part);
+            size_t draw_edges( size_t begin, size_t end);
+            void composite( size_t begin, size_t end);
+            void raster_face( screen_tile& t, size_t facenum);
+            void sort_front_to_back();
+            void shade_visbuf( int ybegin, int yend, size_t& fetches);
+            color filtered_texel( double u, double v);
+
+            void render_lines();
+            void render_triangles();
+
+            void clear_screen();
+            void display_zbuf();
+
+
+            // Color buffer:
+            screen_tile whole_screen() const
+            {
+                screen_tile t;
+                t.x1 = BUF_WIDTH;
+                t.y1 = BUF_HEIGHT;
+                t.zbuf = zbuf;
+                t.cbuf = cbuf;
+                t.vbuf = vbuf;
+                return t;
+            }
+
+            void draw_point( screen_tile& t, int x, int y)
+            {
+                if ((t.x0 <= x) and (x < t.x1) and
+                    (t.y0 <= y) and (y < t.y1))
+                    t.cbuf[x + y * STRIDE] = t.color;
+            }
+
+
+            // Pimitives (clipped to the tile):
+            void draw_line( screen_tile& t, int x1, int y1, int x2, int y2);
+            void draw_line( screen_tile& t, vec2i v1, vec2i v2);
+            size_t draw_edge( vec3i v1, vec3i v2, uint32_t color,
+                              const zbuf_depth_t* depths = nullptr);
+                                                // no tile, the whole view
+
+            void draw_triangle( screen_tile& t,
+                                vec2i v1, vec2i v2, vec2i v3);  // no zbuf
+
+            void draw_triangle( screen_tile& t, vec3i v1, vec3i v2, vec3i v3);
+            void only_fill_zbuf( screen_tile& t, vec3i v1, vec3i v2, vec3i v3,
+                                 uint32_t id = 0);  // id != 0 -> vbuf
+
+            void draw_triangle( screen_tile& t,
+                                vec3i v1, vec3i v2, vec3i v3,
+                                vec2i t1, vec2i t2, vec2i t3,
+                                double intensity);
+
+
+            void project_clusters( size_t begin, size_t end,
+                                   const vec3d& light,
+                                   size_t& culled, screen_rect& box);
+            bool cluster_visible( const mesh_cluster& c) const;
+            size_t select_lod() const;
+
+            void project_face(  tuple_triangle3i_double_bool*& info,
+                                size_t infoIDX,
+                                size_t facenum,
+                                const vec3d& light);
+
+
+             /* zbuf */
+             size_t zbuf_clear( const screen_rect& r);
+             void touch_tile( screen_tile& t);
+
+        public:
+            /* buffers of width x height pixels, rows <stride> apart
+               (0: width); the model is not copied, it must outlive
+               the renderer, and so must the workers */
+            Renderer( const obj_model& model, int width, int height,
+                      scheduler& workers, int stride = 0);
+
+            Renderer( const Renderer&)            = delete;
+            Renderer& operator=( const Renderer&) = delete;
+
+            int width()  const { return BUF_WIDTH; }
+            int height() const { return BUF_HEIGHT; }
+            int stride() const { return STRIDE; }
+
+            /* the frames take <scale> of the buffer side, the top left */
+            void set_resolution( double scale);
+            int  view_width()  const { return VIEW_WIDTH; }
+            int  view_height() const { return VIEW_HEIGHT; }
+
+            /* progressive samples: the pixel centers moved by the jitter,
+               bilinear texels */
+            void set_sample( double jitter_x, double jitter_y, bool filter);
+
+            void set_lod_threshold( double pixels) { lod_threshold = pixels; }
+
+            /* a frame drawn while *flag is set is only for the caller:
+               no history is kept of it */
+            void set_cancel_flag( const std::atomic<bool>* flag) { cancel = flag; }
+
+            /* draws <view> into <target> (cleared first),
+               returns the counters of the frame; throws no_texture
+               for TEXTURE and VISBUF if the model has none */
+            const frame_stats& render( const view_state& view,
+                                       const render_target& target);
+
+            /* the sample just drawn added to the sums, their average
+               put into its color buffer (<samples> counts it too) */
+            void accumulate( size_t samples);
+
+            /* the frame just drawn, if it was reprojected,
+               against the same view drawn in full */
+            std::optional<reprojection_error> check_reprojection();
+
+            /* of the frame just drawn */
+            const zbuf_depth_t* depths() const { return zbuf; }
+    };
+
+
+
+
+    // Exceptions:
+        class bad_mode : public std::exception
+        {
+            public:
+                virtual const char* what() const noexcept override
+                { return "Incorrect rendering mode provided"; }
+        };
+
+        class no_texture : public std::exception
+        {
+            public:
+                virtual const char* what() const noexcept override
+                { return "The model has no texture to draw this mode with"; }
+        };
+}
+
+#endif
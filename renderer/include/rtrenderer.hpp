@@ -1,23 +1,37 @@
 #ifndef RTRENDERER_H_INCLUDDED
 #define RTRENDERER_H_INCLUDDED
 
-#include "obj_parser.hpp"
-#include "geometry.hpp"
+#include "renderer.hpp"
+#include "asset_registry.hpp"
+#include "video.hpp"
+#include "frame_ring.hpp"
+#include "image_writer.hpp"
 
 #include <SDL.h>
 
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <memory>
+#include <atomic>
 #include <thread>
+#include <vector>
+#include <numeric>
+#include <chrono>
 #include <exception>
 #include <string>
+#include <fstream>
+#include <sstream>
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <cstdio>
 #include <cassert>
 
 
-//#define USE_MEMSET
-
-
 
 namespace RTR
 {
@@ -27,28 +41,11 @@ namespace RTR
 
 
 
-    const uint8_t R_BGR = 0;
-    const uint8_t G_BGR = 0;
-    const uint8_t B_BGR = 0;
-    const uint8_t A_BGR = 255;
-    
-    const double PERSPECTIVE_FOCUS = -0.5;
-
-    const double W_SHIFT_DEFAULT        = 0.;  // determines .obj position
-    const double H_SHIFT_DEFAULT        = 0.;   // on the screen
-    const double D_SHIFT_DEFAULT        = -0.5;   // 
-    const double OBJ_SCALE_DEFAULT      = 400.;  // determines size of the model on the screen
-
     const double Y_SHIFT_SPEED_DEFAULT    = 0.15;  // WASD speed
     const double X_SHIFT_SPEED_DEFAULT    = 0.15;  //
     const double Z_SHIFT_SPEED_DEFAULT    = 0.15;  //
 
 
-    using zbuf_depth_t              = int8_t; // 16 or 8 bits 
-    const int ZBUF_SCALE            = 50;  
-
-
-    const quaterniond ORIENTATION_DEFAULT( 0, 0, 1, 0);
     // rotation to a = 10 * 2 degrees;
     const quaterniond X_ROT_SPEED_DEFAULT( 0.98480775301, 0.17364817766, 0, 0);
     const quaterniond Y_ROT_SPEED_DEFAULT( 0.98480775301, 0, 0.17364817766, 0);
@@ -56,60 +53,90 @@ namespace RTR
     
     
     const char* const usage_info =
-    "Usage: [-s <FIGURE>] [-o <FILE>] [-m <MODE>]\n";
+    "Usage: [-s <FIGURE>] [-o <FILE>] [-m <MODE>] [-p] [-f] [-c] [-l <PIXELS>] [-t]\n"
+    "       [-j <THREADS>] [-a] [-r <CORE>] [-g] [-q <FRAMES>] [-d <MS>]\n"
+    "       [-e <SAMPLES>] [-u] [-w <WIDTH>x<HEIGHT>] [-b <FRAMES>|<FILE>]\n"
+    "       [-i <PREFIX>] [-x <FORMAT>] [-y <VIDEO>] [-n <NAME>] [-z]\n";
 
 
 
     /* Parallelism */
-    const size_t N_MACHINES = 5;
+    const size_t N_THREADS_DEFAULT = 0; // std::thread::hardware_concurrency()
+    const size_t FRAMES_IN_FLIGHT_DEFAULT = 2;  // rendered while one is shown
+    const Uint32 INPUT_TICK_MS  = 10;   // held keys are sampled this often
+    const double HOLD_STEP_MS   = 100.; // ... and move a step per this long
 
 
+    /* Dynamic resolution (-d) */
+    const double RES_SMOOTHING  = 0.25; // weight of the newest frame time
+    const double RES_DEADBAND   = 0.1;  // frame time error left alone
+    const double RES_MAX_STEP   = 1.25; // side change per frame, each way
 
 
-    // Supported modes:
-        enum mode_t
-        {
-            GOLD,
-            NOT_GOLD,
-            TRIANGLE,
-            WIREFRAME,
-            RAND,
-            RAST,
-            N_RM_RST,
-            TEXTURE,
-            ZBUF,
-
-            null
-        };
+    /* Progressive refinement (-e) */
+    const double PREVIEW_SCALE  = 0.5;  // of the resolution, while moving
 
 
-    // The main class:
+    /* Batch rendering (-b) */
+    const char* const BATCH_PREFIX_DEFAULT = "frame";  // <prefix>_0000.ppm, ...
+    const int    VIDEO_FPS      = 25;   // of the -y stream
+
+
+    /* Shared memory frames (-n) */
+    const size_t FRAME_RING_SLOTS = 3;  // frames kept for the readers
+
+
+
+
+    // The main class: an SDL window on top of the Renderer,
+    // the input, the frame pipeline and the batch output
     class Window
     {
-        obj_model   model;
+        model_ptr   model;      // (shared with whoever loads the same file)
         mode_t      mode    = null;
 
         double W_SHIFT    = W_SHIFT_DEFAULT;   // determine .obj
         double H_SHIFT    = H_SHIFT_DEFAULT;   // position
         double D_SHIFT    = D_SHIFT_DEFAULT;   // position
-        double OBJ_SCALE  = OBJ_SCALE_DEFAULT; // on the screen
         
         quaterniond  orientation = ORIENTATION_DEFAULT;
 
+        bool depth_prepass  = false;    // TEXTURE: fill zbuf, then shade
+        bool front_to_back  = false;    // sort faces by depth every frame
+        bool backface_culling = false;  // drop faces turned away from us
+        bool sort_last      = false;    // -g: a range of faces per worker
+        bool reproject      = false;    // -u: warp the last frame
+
+        double lod_threshold = LOD_THRESHOLD_DEFAULT;   // <= 0: source mesh only
+        bool show_stats     = false;    // print frame_stats after a frame
+
 
 
 
-        zbuf_depth_t*   zbuf     = nullptr;
-        zbuf_depth_t    zbuf_min =
-                            std::numeric_limits<zbuf_depth_t>::max();
-        zbuf_depth_t    zbuf_max =
-                            std::numeric_limits<zbuf_depth_t>::min();
+        // Dirty rectangles: only what changed is uploaded
+        screen_rect     tex_dirty;              // texture not background
+        size_t          bytes_uploaded = 0;     // last present()
+
+        uint32_t*       screen_buf = nullptr; // unless frames are pipelined
 
         SDL_Renderer*   renderer = nullptr;
         SDL_Window*     window   = nullptr;
+        SDL_Texture*    frame    = nullptr; // frames go to the screen here
         int         WIN_WIDTH    = WIN_WIDTH_DEFAULT;
         int         WIN_HEIGHT   = WIN_HEIGHT_DEFAULT;
 
+        // Dynamic resolution: frames are drawn into the top left corner
+        // of the buffers and stretched over the window when presented
+        double      res_scale    = 1.;  // what the -d controller asks for
+        double      target_ms    = 0;   // -d, 0: always the whole window
+        double      frame_ms_avg = 0;   // smoothed render time
+
+        // Progressive refinement: a cheap preview for new input,
+        // then the same view again at full resolution with filtered
+        // textures, averaged over jittered samples
+        bool        progressive     = false;
+        size_t      refine_samples  = 1;
+
         double X_SPEED    = 0;  //
         double Y_SPEED    = 0;  //
         double Z_SPEED    = 0;  //
@@ -119,43 +146,78 @@ namespace RTR
         quaterniond Z_ROT_SPEED = Z_ROT_SPEED_DEFAULT;
 
 
-        std::thread* pool = nullptr;
-
-        private:
-            /* draw the <mode_t> target */
-            void draw_target(mode_t);
+        size_t      n_threads       = N_THREADS_DEFAULT;
+        bool        pin_threads     = false;    // one core per worker
+        int         present_core    = -1;       // kept for the main thread
 
-            void render_mode_threaded();
-            
-            void render_lines();
-            void render_triangles();
+        std::unique_ptr<scheduler> workers;
+        std::unique_ptr<Renderer>  core;        // draws every frame
 
-            void clear_screen();
-            void display_zbuf();
-
-
-            // Pimitives:
-            void draw_line( int x1, int y1, int x2, int y2);
-            void draw_line( vec2i v1, vec2i v2);
+        // Pipelined frames (dynamic modes):
+        // a render thread draws into one of the targets
+        // while the main thread, which owns SDL, presents another one
+        size_t                  frames_in_flight = FRAMES_IN_FLIGHT_DEFAULT;
+        struct frame_target
+        {
+            std::vector<uint32_t>   pixels;
+            Uint32                  input_ms = 0;   // of the view drawn
+            SDL_Rect                rect{};         // ... the part drawn
+            screen_rect             dirty;          // not background
+            bool                    refined = false;// ... not for new input
+        };
 
-            void draw_triangle( vec2i v1, vec2i v2, vec2i v3);  // no zbuf
+        std::vector<frame_target> targets;
+        std::deque<size_t>      free_targets;
+        std::deque<size_t>      ready_targets;
+        std::optional<view_state> pending_view; // newest input, not started
+        std::exception_ptr      render_error;
+        std::thread             render_thread;
+        std::mutex              pipe_m;
+        std::condition_variable pipe_cv;
+        bool                    pipe_stop = false;
+        Uint32                  frame_ready_event = 0;
+        bool                    refining = false;   // frame being drawn
+        std::atomic<bool>       cancel_frame{false}; // new input came
+
+        // input-to-present latency, measured by the main thread
+        Uint32                  latency_max = 0;
+        double                  latency_sum = 0;
+        size_t                  presented   = 0;
+        size_t                  dropped     = 0;    // drawn, never shown
+
+        // Batch: views drawn into numbered images instead of the window
+        std::string             batch_views;    // frame count or a file
+        std::string             batch_prefix = BATCH_PREFIX_DEFAULT;
+        image_writer::format_t  batch_format = image_writer::PPM;
+        std::string             video_path;     // -y: a Y4M stream instead
+
+        // Frames published for other processes (-n, -z adds the depths)
+        std::string                 ring_name;
+        bool                        ring_depths = false;
+        std::unique_ptr<frame_ring> ring;
 
-            void draw_triangle( vec3i v1, vec3i v2, vec3i v3);
-            void only_fill_zbuf( vec3i v1, vec3i v2, vec3i v3);
+        private:
+            void start_workers();
 
-            void draw_triangle( vec3i v1, vec3i v2, vec3i v3,
-                                vec2i t1, vec2i t2, vec2i t3,
-                                double intensity);
+            view_state current_view() const;
+            void adapt_resolution( double frame_ms);
+            size_t refine_levels( mode_t m) const;
 
+            std::vector<view_state> batch_list() const;
 
-            void project_face(  tuple_triangle3i_double_bool*& info,
-                                size_t infoIDX,
-                                size_t facenum,
-                                const vec3d& light);
+            void start_pipeline();
+            void stop_pipeline();
+            void submit_frame( const view_state& v);
+            void render_loop();
+            void present_ready();
 
+            void present( const uint32_t* pixels,
+                          const SDL_Rect* rect = nullptr,
+                          const screen_rect* dirty = nullptr);
 
-             /* zbuf */
-             void zbuf_clear();
+            /* -t: the counters of a frame of <v>, sample <level> */
+            void print_stats( const frame_stats& stats, const view_state& v,
+                              size_t level) const;
 
         public:
             Window( int argc, char** argv, char* filename);
@@ -170,21 +232,23 @@ namespace RTR
             void do_task();
             void static_display();
             void dynamic_display();
+            void batch_display();
+
+            /* draw every view into <prefix>_0000.ppm, <prefix>_0001.ppm, ...
+               (or .qoi, .png) or, if <video> is given, into a Y4M stream
+               there ("-": stdout) */
+            void render_batch( const std::vector<view_state>& views,
+                               const std::string& prefix,
+                               image_writer::format_t format = image_writer::PPM,
+                               const std::string& video = "");
+     static std::vector<view_state> turntable( const view_state& first,
+                                               size_t frames);
     };
 
 
 
 
     // Exceptions:
-        class bad_mode : public std::exception
-        {
-            public:
-                virtual const char* what() const noexcept override
-                { return "Incorrect rendering mode provided"; }
-        };
-
-
-
         class bad_input : public std::exception
         {
             public:
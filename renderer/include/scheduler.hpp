@@ -0,0 +1,173 @@
+#ifndef SCHEDULER_H_INCLUDDED
+#define SCHEDULER_H_INCLUDDED
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+
+namespace RTR
+{
+    // Work-stealing thread pool:
+    // every worker has its own deque, runs its newest task first and
+    // steals the oldest task of another worker when its deque is empty.
+    // A thread waiting for a group of tasks keeps running tasks meanwhile,
+    // so tasks may spawn and wait for tasks themselves.
+    class scheduler
+    {
+        public:
+            // A set of tasks that can be waited for
+            class group
+            {
+                std::atomic<size_t>     pending{0};
+                std::exception_ptr      error;
+                std::mutex              error_m;
+
+                friend class scheduler;
+            };
+
+
+            struct counters
+            {
+                size_t tasks        = 0;    // tasks run
+                size_t steals       = 0;    // ... taken from another deque
+                size_t idle_waits   = 0;    // times a worker went to sleep
+                double idle_ms      = 0;    // time workers slept
+            };
+
+
+            // The counters of one caller (a frame, ...) of a scheduler
+            // shared with others: the tasks spawned by a thread while a
+            // tally_scope is alive on it, and the tasks these spawn in
+            // turn, count into its tally whichever thread runs them;
+            // idle is then the time spent waiting for them with nothing
+            // to run (idle_waits: how many times)
+            class tally
+            {
+                std::atomic<size_t>     tasks{0};
+                std::atomic<size_t>     steals{0};
+                std::atomic<size_t>     idle_waits{0};
+                std::atomic<uint64_t>   idle_ns{0};
+
+                friend class scheduler;
+
+                public:
+                    counters get() const;
+                    void     reset();
+            };
+
+            class tally_scope
+            {
+                tally* prev;
+
+                public:
+                    explicit tally_scope( tally& t);
+                    ~tally_scope();
+
+                    tally_scope( const tally_scope&)            = delete;
+                    tally_scope& operator=( const tally_scope&) = delete;
+            };
+
+
+            // <nthreads> includes the thread that waits (-1 workers),
+            // worker i is pinned to cores[i % cores.size()] if any
+            explicit scheduler( size_t nthreads,
+                                const std::vector<size_t>& cores = {});
+            ~scheduler();
+
+            scheduler( const scheduler&)            = delete;
+            scheduler& operator=( const scheduler&) = delete;
+
+            // threads that run tasks (the waiting thread helps too)
+            size_t size() const { return threads.size() + 1; }
+
+            // false if the platform can not do it
+            static bool pin_to_core( size_t core);
+
+            void spawn( group& g, std::function<void()> fn);
+            void wait( group& g);       // rethrows the first exception
+
+            // body( chunk_begin, chunk_end) for chunks of <grain> indices
+            void parallel_for( size_t begin, size_t end, size_t grain,
+                               const std::function<void(size_t, size_t)>& body);
+
+            // of every caller together
+            counters stats() const;
+            void     reset_stats();
+
+
+        private:
+            struct task
+            {
+                std::function<void()>  fn;
+                group*                  g = nullptr;
+                tally*                  t = nullptr;    // of the spawning thread
+            };
+
+            struct worker_queue
+            {
+                std::mutex              m;
+                std::deque<task>        tasks;
+
+                std::atomic<size_t>     ran{0};
+                std::atomic<size_t>     stolen{0};
+                std::atomic<size_t>     idle_waits{0};
+                std::atomic<uint64_t>   idle_ns{0};
+            };
+
+            // one per worker, the last one is shared
+            // by all the other threads
+            std::vector<std::unique_ptr<worker_queue>> queues;
+            std::vector<std::thread>    threads;
+
+            std::mutex                  idle_m;
+            std::condition_variable     idle_cv;
+            std::atomic<size_t>         queued{0};
+            std::atomic<int64_t>        epoch_ns{0};    // of reset_stats()
+            bool                        stop = false;
+
+            size_t  self() const;
+            bool    try_run( size_t self);
+            void    run( size_t self, task& t, bool stolen);
+            void    worker_loop( size_t id);
+    };
+
+
+
+
+    // Tasks with dependencies:
+    // a node is spawned once all of the nodes preceding it are done
+    class task_graph
+    {
+        public:
+            using node_id = size_t;
+
+            node_id add( std::function<void()> fn);
+            void    precede( node_id before, node_id after);
+
+            void    run( scheduler& s);     // blocks until every node ran
+
+        private:
+            struct node
+            {
+                std::function<void()>   fn;
+                std::vector<node_id>    next;
+                size_t                  deps = 0;
+                std::atomic<size_t>     pending{0};
+            };
+
+            std::vector<std::unique_ptr<node>> nodes;
+
+            void spawn( scheduler& s, scheduler::group& g, node_id id);
+    };
+}
+
+#endif
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+#include "geometry.hpp"
+
+
+
+// Error quadric of Garland & Heckbert: sum of squared distances to planes
+struct quadric
+{
+  double a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
+  double b1 = 0, b2 = 0, b3 = 0;
+  double c = 0;
+
+  constexpr quadric() {}
+
+  // plane n * x + d = 0 (n is a unit vector)
+  constexpr quadric(const vec3d &n, double d, double w = 1)
+    : a11{w * n.x * n.x}, a12{w * n.x * n.y}, a13{w * n.x * n.z},
+      a22{w * n.y * n.y}, a23{w * n.y * n.z}, a33{w * n.z * n.z},
+      b1{w * d * n.x}, b2{w * d * n.y}, b3{w * d * n.z},
+      c{w * d * d} {}
+
+  constexpr quadric& operator+=(const quadric &q)
+  {
+    a11 += q.a11; a12 += q.a12; a13 += q.a13;
+    a22 += q.a22; a23 += q.a23; a33 += q.a33;
+    b1 += q.b1; b2 += q.b2; b3 += q.b3;
+    c += q.c;
+    return *this;
+  }
+
+  constexpr double operator()(const vec3d &v) const
+  {
+    double e = a11 * v.x * v.x + 2 * a12 * v.x * v.y + 2 * a13 * v.x * v.z +
+               a22 * v.y * v.y + 2 * a23 * v.y * v.z + a33 * v.z * v.z +
+               2 * (b1 * v.x + b2 * v.y + b3 * v.z) + c;
+    return e > 0 ? e : 0;
+  }
+};
+
+
+
+// Half-edge collapse simplifier: a vertex is merged into its neighbour,
+// so no new vertices appear and every corner keeps its texture index.
+// Collapses may be continued to build a chain of levels of detail.
+class mesh_simplifier
+{
+private:
+  static constexpr double BOUNDARY_WEIGHT = 10;   // keeps open borders
+  static constexpr double MIN_NORMAL_COS  = 0.2;  // no folded faces
+
+  struct candidate
+  {
+    double   cost;
+    uint32_t from, to;
+    uint32_t stamp_from, stamp_to;
+
+    bool operator>(const candidate &another) const
+    { return cost > another.cost; }
+  };
+
+  const std::vector<vec3d> &verts;
+  std::vector<std::vector<vec3i>> corners;    // v/vt/vn of every face
+  std::vector<bool> alive;
+  size_t live = 0;
+
+  std::vector<quadric> quadrics;
+  std::vector<uint32_t> stamps;
+  std::vector<bool> removed;
+  std::vector<std::vector<uint32_t>> vert_faces;
+
+  std::priority_queue<candidate, std::vector<candidate>,
+                      std::greater<candidate>> heap;
+
+  double max_cost = 0;
+
+
+
+  vec3d normal(uint32_t f, uint32_t from, uint32_t to) const
+  {
+    vec3d p[3];
+    for(size_t k = 0; k < 3; ++k)
+    {
+      uint32_t v = corners[f][k][0];
+      p[k] = verts[v == from ? to : v];
+    }
+    vec3d n = (p[1] - p[0]) ^ (p[2] - p[0]);
+    return n.norm() > 0 ? n.normalize() : n;
+  }
+
+  void push(uint32_t from, uint32_t to)
+  {
+    quadric q = quadrics[from];
+    q += quadrics[to];
+    heap.push({q(verts[to]), from, to, stamps[from], stamps[to]});
+  }
+
+  // moving "from" onto "to" must not turn any of the remaining faces over
+  bool valid(uint32_t from, uint32_t to) const
+  {
+    for(uint32_t f : vert_faces[from])
+    {
+      if(!alive[f])
+        continue;
+
+      bool shared = false;
+      for(size_t k = 0; k < 3; ++k)
+        shared |= (uint32_t(corners[f][k][0]) == to);
+      if(shared)
+        continue;
+
+      vec3d before = normal(f, from, from);
+      vec3d after  = normal(f, from, to);
+      if(after.norm() == 0 or before * after < MIN_NORMAL_COS)
+        return false;
+    }
+    return true;
+  }
+
+  void collapse(uint32_t from, uint32_t to)
+  {
+    for(uint32_t f : vert_faces[from])
+    {
+      if(!alive[f])
+        continue;
+
+      bool shared = false;
+      for(size_t k = 0; k < 3; ++k)
+        shared |= (uint32_t(corners[f][k][0]) == to);
+
+      if(shared)
+      {
+        alive[f] = false;
+        live--;
+        continue;
+      }
+
+      for(size_t k = 0; k < 3; ++k)
+        if(uint32_t(corners[f][k][0]) == from)
+          corners[f][k][0] = to;
+      vert_faces[to].push_back(f);
+    }
+
+    vert_faces[from].clear();
+    removed[from] = true;
+    quadrics[to] += quadrics[from];
+    stamps[to]++;
+
+    // the edges around "to" have new costs now
+    std::vector<uint32_t> kept;
+    for(uint32_t f : vert_faces[to])
+    {
+      if(!alive[f])
+        continue;
+      kept.push_back(f);
+
+      for(size_t k = 0; k < 3; ++k)
+      {
+        uint32_t v = corners[f][k][0];
+        if(v == to)
+          continue;
+        push(v, to);
+        push(to, v);
+      }
+    }
+    vert_faces[to].swap(kept);
+  }
+
+public:
+  mesh_simplifier(const std::vector<vec3d> &vertices,
+                  const std::vector<std::vector<vec3i>> &faces)
+    : verts{vertices}, corners{faces}, alive(faces.size(), true),
+      live{faces.size()}, quadrics(vertices.size()),
+      stamps(vertices.size(), 0), removed(vertices.size(), false),
+      vert_faces(vertices.size())
+  {
+    for(size_t f = 0; f < corners.size(); ++f)
+    {
+      vec3d n = normal(f, 0, 0);
+      if(n.norm() == 0)
+        n = vec3d();
+      const vec3d &p0 = verts[corners[f][0][0]];
+      quadric q(n, -(n * p0));
+
+      for(size_t k = 0; k < 3; ++k)
+      {
+        quadrics[corners[f][k][0]] += q;
+        vert_faces[corners[f][k][0]].push_back(f);
+      }
+    }
+
+    // border edges (used by one face) get a plane across the face
+    for(size_t f = 0; f < corners.size(); ++f)
+      for(size_t k = 0; k < 3; ++k)
+      {
+        uint32_t a = corners[f][k][0];
+        uint32_t b = corners[f][(k + 1) % 3][0];
+
+        size_t users = 0;
+        for(uint32_t g : vert_faces[a])
+          for(size_t m = 0; m < 3; ++m)
+            users += (uint32_t(corners[g][m][0]) == b);
+
+        if(users == 1)
+        {
+          vec3d e = verts[b] - verts[a];
+          vec3d n = e ^ normal(f, 0, 0);
+          if(n.norm() == 0)
+            continue;
+          n.normalize();
+          quadric q(n, -(n * verts[a]), BOUNDARY_WEIGHT);
+          quadrics[a] += q;
+          quadrics[b] += q;
+        }
+      }
+
+    for(size_t f = 0; f < corners.size(); ++f)
+      for(size_t k = 0; k < 3; ++k)
+      {
+        uint32_t a = corners[f][k][0];
+        uint32_t b = corners[f][(k + 1) % 3][0];
+        push(a, b);
+        push(b, a);
+      }
+  }
+
+
+
+  // collapses the cheapest edges until at most target faces are left,
+  // returns false if there is nothing more to collapse
+  bool simplify(size_t target)
+  {
+    while(live > target)
+    {
+      if(heap.empty())
+        return false;
+
+      candidate c = heap.top();
+      heap.pop();
+
+      if(removed[c.from] or removed[c.to] or
+         (c.stamp_from != stamps[c.from]) or (c.stamp_to != stamps[c.to]))
+        continue;
+
+      if(!valid(c.from, c.to))
+        continue;
+
+      max_cost = std::max(max_cost, c.cost);
+      collapse(c.from, c.to);
+    }
+    return true;
+  }
+
+  size_t nfaces() const { return live; }
+
+  // bound on the distance to the source surface (model units)
+  double error() const { return std::sqrt(max_cost); }
+
+  std::vector<std::vector<vec3i>> faces() const
+  {
+    std::vector<std::vector<vec3i>> res;
+    res.reserve(live);
+    for(size_t f = 0; f < corners.size(); ++f)
+      if(alive[f])
+        res.push_back(corners[f]);
+    return res;
+  }
+};
@@ -0,0 +1,46 @@
+#ifndef VIDEO_H_INCLUDDED
+#define VIDEO_H_INCLUDDED
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+
+namespace RTR
+{
+    // YUV4MPEG2 stream of frames for an encoder reading a file,
+    // a named pipe or stdout ("-"): 4:2:0, full range BT.601.
+    // The planes of a frame are converted into the same buffer every time
+    // and written at once.
+    class y4m_writer
+    {
+        public:
+            y4m_writer( const std::string& path, int width, int height,
+                        int fps);
+            ~y4m_writer();
+
+            y4m_writer( const y4m_writer&)            = delete;
+            y4m_writer& operator=( const y4m_writer&) = delete;
+
+            // the top left width x height of RGB888 pixels,
+            // rows of <stride> pixels
+            void write( const uint32_t* pixels, int stride);
+
+            // (chroma of a 2 x 2 block, the last row and column
+            //  repeated for odd sizes)
+            static void rgb_to_yuv420( const uint32_t* pixels, int width,
+                                       int height, int stride, uint8_t* y,
+                                       uint8_t* u, uint8_t* v);
+
+        private:
+            FILE*                   out     = nullptr;
+            bool                    owned   = false;    // not stdout
+            int                     width   = 0;
+            int                     height  = 0;
+            std::vector<uint8_t>    planes;             // Y, U, then V
+    };
+}
+
+#endif
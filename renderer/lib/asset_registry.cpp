@@ -0,0 +1,183 @@
+#include "asset_registry.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+
+
+namespace
+{
+    // (one name for the ways of naming the same file)
+    std::filesystem::path canonical_path( const std::filesystem::path& path)
+    {
+        std::error_code ec;
+        std::filesystem::path res = std::filesystem::weakly_canonical( path, ec);
+        return ec ? path : res;
+    }
+
+    std::string key_of( const std::filesystem::path& path, uint64_t hash)
+    {
+        return path.string() + '\n' + std::to_string( hash);
+    }
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Lookup:
+//
+    RTR::asset_registry& RTR::asset_registry::shared()
+    {
+        static asset_registry registry;
+        return registry;
+    }
+
+
+
+    RTR::model_ptr RTR::asset_registry::model( const std::filesystem::path& path)
+    {
+        std::filesystem::path obj = canonical_path( path);
+        std::filesystem::path tga = obj_model::diffuse_path( obj);
+
+        // (the texture is a part of the model: a new one makes a new model)
+        uint64_t tga_hash = file_hash( tga);
+        std::string key   = key_of( obj, file_hash( obj)) + '\n' + std::to_string( tga_hash);
+
+        return acquire( models, key, [&]
+        {
+            texture_ptr diffuse = tga_hash ? texture( tga) : nullptr;
+            auto res = std::make_shared<const obj_model>( obj, diffuse);
+            if (diffuse == nullptr)
+                std::cerr << "Warning: no texture found"  << std::endl;
+            return res;
+        });
+    }
+
+
+
+    texture_ptr RTR::asset_registry::texture( const std::filesystem::path& path)
+    {
+        std::filesystem::path tga = canonical_path( path);
+
+        return acquire( textures, key_of( tga, file_hash( tga)), [&]
+        {
+            return std::make_shared<const tga_image>( tga);
+        });
+    }
+
+
+
+    template <class T, class Load>
+    std::shared_ptr<const T> RTR::asset_registry::acquire(
+                            std::unordered_map<std::string, slot<T>>& slots,
+                            const std::string& key, Load load)
+    {
+        std::shared_future<std::shared_ptr<const T>>    found;
+        std::promise<std::shared_ptr<const T>>          loading;
+        {
+            std::lock_guard<std::mutex> lock( m);
+            slot<T>& s = slots[ key];
+            if (auto asset = s.asset.lock())
+                return asset;
+
+            if (s.loading.valid())
+                found = s.loading;
+            else
+                s.loading = loading.get_future().share();
+        }
+
+        if (found.valid())
+            return found.get();
+
+        std::shared_ptr<const T> asset;
+        try
+        {
+            asset = load();
+        }
+        catch (...)
+        {
+            // (the next request tries again)
+            loading.set_exception( std::current_exception());
+            std::lock_guard<std::mutex> lock( m);
+            slots.erase( key);
+            throw;
+        }
+
+        loading.set_value( asset);
+
+        std::lock_guard<std::mutex> lock( m);
+        slot<T>& s = slots[ key];
+        s.asset    = asset;
+        s.loading  = {};    // (it holds a reference)
+
+        // the assets nobody holds any more are forgotten
+        for (auto it = slots.begin(); it != slots.end(); )
+        {
+            if (it->second.asset.expired() and !it->second.loading.valid())
+                it = slots.erase( it);
+            else
+                ++it;
+        }
+
+        return asset;
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Hashes:
+//
+    uint64_t RTR::asset_registry::file_hash( const std::filesystem::path& path)
+    {
+        std::error_code ec;
+        file_stamp now;
+        now.size  = std::filesystem::file_size( path, ec);
+        if (!ec)
+            now.mtime = std::filesystem::last_write_time( path, ec);
+        if (ec)
+            return 0;
+
+        {
+            std::lock_guard<std::mutex> lock( m);
+            auto it = stamps.find( path.string());
+            if ((it != stamps.end()) and (it->second.size == now.size) and
+                (it->second.mtime == now.mtime))
+                return it->second.hash;
+        }
+
+        // (read without the lock, a mesh can take a while)
+        now.hash = content_hash( path);
+
+        std::lock_guard<std::mutex> lock( m);
+        stamps[ path.string()] = now;
+        return now.hash;
+    }
+
+
+
+    uint64_t RTR::asset_registry::content_hash( const std::filesystem::path& path)
+    {
+        std::ifstream ifs( path, std::ios::binary);
+        if (!ifs)
+            return 0;
+
+        uint64_t hash = 0xcbf29ce484222325ull;
+        std::vector<char> chunk( 1 << 20);
+        while (ifs)
+        {
+            ifs.read( chunk.data(), chunk.size());
+            for (std::streamsize i = 0; i < ifs.gcount(); ++i)
+                hash = (hash ^ static_cast<unsigned char>( chunk[i])) * 0x100000001b3ull;
+        }
+
+        // (0 is kept for the files that can't be read)
+        return hash ? hash : 1;
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
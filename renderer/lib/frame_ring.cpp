@@ -0,0 +1,269 @@
+#include "frame_ring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FRAME_RING_SHM 1
+#endif
+
+
+namespace
+{
+    // (shm_open wants a single leading slash)
+    std::string shm_name( const std::string& name)
+    {
+        return (name.empty() or (name[0] != '/')) ? "/" + name : name;
+    }
+
+    size_t slot_size( uint32_t width, uint32_t height, bool depths)
+    {
+        size_t pixels = size_t( width) * height;
+        size_t bytes  = RTR::FRAME_RING_DATA + pixels * sizeof( uint32_t) +
+                        (depths ? pixels * sizeof( int8_t) : 0);
+        return (bytes + 63) & ~size_t( 63);
+    }
+
+    RTR::frame_ring_slot* slot_at( RTR::frame_ring_header* header, size_t i)
+    {
+        char* base = reinterpret_cast<char*>( header) + RTR::FRAME_RING_DATA;
+        return reinterpret_cast<RTR::frame_ring_slot*>( base + i * header->slot_bytes);
+    }
+
+    uint32_t* slot_pixels( RTR::frame_ring_slot* s)
+    {
+        return reinterpret_cast<uint32_t*>( reinterpret_cast<char*>( s) +
+                                            RTR::FRAME_RING_DATA);
+    }
+
+    [[noreturn]] void shm_failure( const std::string& what, const std::string& name)
+    {
+        throw std::runtime_error( what + " shared memory " + name + ": " +
+                                  std::strerror( errno));
+    }
+}
+
+static_assert( sizeof( RTR::frame_ring_header) <= RTR::FRAME_RING_DATA);
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Constructor/Destructor:
+//
+    RTR::frame_ring::frame_ring( const std::string& name, int max_width,
+                                 int max_height, size_t slots, bool depths)
+    : name( shm_name( name)), depths( depths)
+    {
+    #ifdef FRAME_RING_SHM
+        size_t slot_bytes = slot_size( max_width, max_height, depths);
+        bytes = FRAME_RING_DATA + slots * slot_bytes;
+
+        // (a ring left behind by a renderer that crashed is replaced)
+        shm_unlink( this->name.c_str());
+        int fd = shm_open( this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+            shm_failure( "Can't create", this->name);
+
+        if (ftruncate( fd, bytes) != 0)
+        {
+            close( fd);
+            shm_unlink( this->name.c_str());
+            shm_failure( "Can't size", this->name);
+        }
+
+        void* p = mmap( nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close( fd);
+        if (p == MAP_FAILED)
+        {
+            shm_unlink( this->name.c_str());
+            shm_failure( "Can't map", this->name);
+        }
+
+        // (the object starts zeroed: every seq even, nothing published)
+        header = new (p) frame_ring_header;
+        header->version    = FRAME_RING_VERSION;
+        header->slots      = slots;
+        header->slot_bytes = slot_bytes;
+        header->max_width  = max_width;
+        header->max_height = max_height;
+        header->published.store( 0, std::memory_order_relaxed);
+        header->dropped.store( 0, std::memory_order_relaxed);
+        for (size_t i = 0; i < slots; i++)
+            new (slot( i)) frame_ring_slot;
+
+        // (readers check the magic last, after the rest is in place)
+        std::atomic_thread_fence( std::memory_order_release);
+        std::memcpy( header->magic, FRAME_RING_MAGIC, sizeof( header->magic));
+    #else
+        (void) max_width; (void) max_height; (void) slots;
+        throw std::runtime_error( "Shared memory frames need POSIX shm");
+    #endif
+    }
+
+
+
+    RTR::frame_ring::~frame_ring()
+    {
+    #ifdef FRAME_RING_SHM
+        munmap( header, bytes);
+        shm_unlink( name.c_str());
+    #endif
+    }
+
+
+
+    RTR::frame_ring_reader::frame_ring_reader( const std::string& name)
+    {
+    #ifdef FRAME_RING_SHM
+        std::string path = shm_name( name);
+        int fd = shm_open( path.c_str(), O_RDWR, 0);
+        if (fd < 0)
+            shm_failure( "Can't open", path);
+
+        struct stat st;
+        if ((fstat( fd, &st) != 0) or (size_t( st.st_size) < FRAME_RING_DATA))
+        {
+            close( fd);
+            throw std::runtime_error( "Not a frame ring: " + path);
+        }
+        bytes = st.st_size;
+
+        // (read-write: frames seen are marked read)
+        void* p = mmap( nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close( fd);
+        if (p == MAP_FAILED)
+            shm_failure( "Can't map", path);
+
+        header = static_cast<frame_ring_header*>( p);
+        if ((std::memcmp( header->magic, FRAME_RING_MAGIC, sizeof( header->magic)) != 0) or
+            (header->version != FRAME_RING_VERSION) or
+            (FRAME_RING_DATA + header->slots * header->slot_bytes > bytes))
+        {
+            munmap( p, bytes);
+            throw std::runtime_error( "Not a frame ring: " + path);
+        }
+        std::atomic_thread_fence( std::memory_order_acquire);
+    #else
+        (void) name;
+        throw std::runtime_error( "Shared memory frames need POSIX shm");
+    #endif
+    }
+
+
+
+    RTR::frame_ring_reader::~frame_ring_reader()
+    {
+    #ifdef FRAME_RING_SHM
+        munmap( header, bytes);
+    #endif
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Frames:
+//
+    RTR::frame_ring_slot* RTR::frame_ring::slot( size_t i)
+    {
+        return slot_at( header, i);
+    }
+
+
+
+    void RTR::frame_ring::publish( const uint32_t* pixels, const int8_t* depths,
+                                   int width, int height, int stride)
+    {
+        width  = std::min<uint32_t>( width,  header->max_width);
+        height = std::min<uint32_t>( height, header->max_height);
+
+        uint64_t         frame = header->published.load( std::memory_order_relaxed);
+        frame_ring_slot* s     = slot( frame % header->slots);
+
+        // (the frame this one overwrites, if no reader got to it)
+        if ((frame >= header->slots) and
+            (s->read.load( std::memory_order_relaxed) != s->frame + 1))
+            header->dropped.fetch_add( 1, std::memory_order_relaxed);
+
+        uint32_t seq = s->seq.load( std::memory_order_relaxed);
+        s->seq.store( seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence( std::memory_order_release);
+
+        s->format       = FRAME_FORMAT_RGB888;
+        s->depth_format = this->depths ? FRAME_DEPTH_INT8 : FRAME_DEPTH_NONE;
+        s->width        = width;
+        s->height       = height;
+        s->stride       = width;
+        s->frame        = frame;
+
+        // (packed rows: the depths follow the last row of pixels)
+        uint32_t* dst = slot_pixels( s);
+        for (int j = 0; j < height; j++)
+            std::memcpy( dst + size_t( j) * width, pixels + size_t( j) * stride,
+                         width * sizeof( uint32_t));
+
+        if (this->depths)
+        {
+            int8_t* dz = reinterpret_cast<int8_t*>( dst + size_t( width) * height);
+            for (int j = 0; j < height; j++)
+                std::memcpy( dz + size_t( j) * width, depths + size_t( j) * stride,
+                             width * sizeof( int8_t));
+        }
+
+        s->seq.store( seq + 2, std::memory_order_release);
+        header->published.store( frame + 1, std::memory_order_release);
+    }
+
+
+
+    RTR::frame_ring_slot* RTR::frame_ring_reader::slot( size_t i)
+    {
+        return slot_at( header, i);
+    }
+
+
+
+    bool RTR::frame_ring_reader::read_latest( const visitor& use)
+    {
+        uint64_t published = header->published.load( std::memory_order_acquire);
+        if (published == 0)
+            return false;
+
+        frame_ring_slot* s   = slot( (published - 1) % header->slots);
+        uint32_t         seq = s->seq.load( std::memory_order_acquire);
+        if (seq & 1)
+            return false;
+
+        uint64_t        frame  = s->frame;
+        const uint32_t* pixels = slot_pixels( s);
+        const int8_t*   depths = (s->depth_format == FRAME_DEPTH_NONE) ? nullptr :
+                    reinterpret_cast<const int8_t*>( pixels + size_t( s->stride) * s->height);
+
+        // (the sizes are checked as they may be torn as well,
+        // laid out as publish() does: the depths only if the ring has them)
+        size_t pixel_bytes = sizeof( uint32_t) + (depths ? 1 : 0);
+        if ((size_t( s->stride) * s->height * pixel_bytes +
+             FRAME_RING_DATA > header->slot_bytes) or (s->width > s->stride))
+            return false;
+
+        use( *s, pixels, depths);
+
+        std::atomic_thread_fence( std::memory_order_acquire);
+        if (s->seq.load( std::memory_order_relaxed) != seq)
+            return false;
+
+        s->read.store( frame + 1, std::memory_order_relaxed);
+        return true;
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,433 @@
+#include "image_writer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ios>
+#include <stdexcept>
+
+#include <zlib.h>
+
+
+namespace
+{
+    void put_be32( std::vector<uint8_t>& out, uint32_t v)
+    {
+        out.push_back( v >> 24);
+        out.push_back( v >> 16);
+        out.push_back( v >> 8);
+        out.push_back( v);
+    }
+
+    void put_chunk( std::vector<uint8_t>& out, const char* type,
+                    const std::vector<uint8_t>& data)
+    {
+        put_be32( out, data.size());
+        size_t at = out.size();
+        out.insert( out.end(), type, type + 4);
+        out.insert( out.end(), data.begin(), data.end());
+        put_be32( out, crc32( 0, out.data() + at, out.size() - at));
+    }
+
+    void unpack_row( const uint32_t* row, int width, uint8_t* rgb)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            rgb[3 * x]     = row[x] >> 16;
+            rgb[3 * x + 1] = row[x] >> 8;
+            rgb[3 * x + 2] = row[x];
+        }
+    }
+
+    uint8_t paeth( int a, int b, int c)
+    {
+        int p  = a + b - c;
+        int pa = std::abs( p - a);
+        int pb = std::abs( p - b);
+        int pc = std::abs( p - c);
+        return ((pa <= pb) and (pa <= pc)) ? a : (pb <= pc) ? b : c;
+    }
+
+    double ms_since( std::chrono::steady_clock::time_point t0)
+    {
+        return std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0).count();
+    }
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Constructor:
+//
+    RTR::image_writer::image_writer( format_t format, scheduler* workers)
+    : format( format), workers( workers)
+    {}
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Images:
+//
+    void RTR::image_writer::write( const std::string& path, const uint32_t* pixels,
+                                   int width, int height, int stride)
+    {
+        encode_image( pixels, width, height, stride);
+
+        auto t0 = std::chrono::steady_clock::now();
+        FILE* out = std::fopen( path.c_str(), "wb");
+        if (out == nullptr)
+            throw std::ios_base::failure( "Can't open " + path);
+        std::setvbuf( out, nullptr, _IOFBF, 1 << 20);
+
+        auto put = [&]( const std::vector<uint8_t>& data)
+        {
+            return std::fwrite( data.data(), 1, data.size(), out) == data.size();
+        };
+
+        bool ok = put( head);
+        if (format == PNG)
+            for (const strip& s : strips)
+                ok = ok and put( s.data);
+        else
+            ok = ok and put( body);
+        ok = ok and put( tail);
+
+        if ((std::fclose( out) != 0) or !ok)
+            throw std::ios_base::failure( "Can't write " + path);
+        written_ms = ms_since( t0);
+    }
+
+
+
+    void RTR::image_writer::encode( const uint32_t* pixels, int width, int height,
+                                    int stride, std::vector<uint8_t>& out)
+    {
+        encode_image( pixels, width, height, stride);
+
+        auto t0 = std::chrono::steady_clock::now();
+        auto put = [&]( const std::vector<uint8_t>& data)
+        {
+            out.insert( out.end(), data.begin(), data.end());
+        };
+
+        out.clear();
+        put( head);
+        if (format == PNG)
+            for (const strip& s : strips)
+                put( s.data);
+        else
+            put( body);
+        put( tail);
+        written_ms = ms_since( t0);
+    }
+
+
+
+    void RTR::image_writer::encode_image( const uint32_t* pixels,
+                                          int width, int height, int stride)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        switch (format)
+        {
+            case PPM : encode_ppm( pixels, width, height, stride); break;
+            case QOI : encode_qoi( pixels, width, height, stride); break;
+            case PNG : encode_png( pixels, width, height, stride); break;
+        }
+        encoded_ms = ms_since( t0);
+    }
+
+
+
+    const char* RTR::image_writer::extension() const
+    {
+        switch (format)
+        {
+            case QOI : return "qoi";
+            case PNG : return "png";
+            default  : return "ppm";
+        }
+    }
+
+
+
+    void RTR::image_writer::encode_ppm( const uint32_t* pixels, int width,
+                                        int height, int stride)
+    {
+        std::string header = "P6\n" + std::to_string( width) + " " +
+                             std::to_string( height) + "\n255\n";
+        head.assign( header.begin(), header.end());
+
+        body.resize( 3 * size_t( width) * height);
+        for (int y = 0; y < height; y++)
+            unpack_row( pixels + size_t( y) * stride, width,
+                        body.data() + 3 * size_t( y) * width);
+
+        tail.clear();
+    }
+
+
+
+    // (the reference encoder of qoiformat.org, without alpha)
+    void RTR::image_writer::encode_qoi( const uint32_t* pixels, int width,
+                                        int height, int stride)
+    {
+        head = { 'q', 'o', 'i', 'f'};
+        put_be32( head, width);
+        put_be32( head, height);
+        head.push_back( 3);     // RGB
+        head.push_back( 0);     // sRGB
+
+        body.resize( 4 * size_t( width) * height);
+        uint8_t* out = body.data();
+
+        uint32_t index[64] = {};
+        uint32_t prev      = 0xff000000;
+        int      run       = 0;
+        for (int y = 0; y < height; y++)
+        {
+            const uint32_t* row = pixels + size_t( y) * stride;
+            for (int x = 0; x < width; x++)
+            {
+                uint32_t p = row[x] | 0xff000000;
+                if (p == prev)
+                {
+                    if (++run == 62)
+                    {
+                        *out++ = 0xc0 | (run - 1);
+                        run = 0;
+                    }
+                    continue;
+                }
+
+                if (run > 0)
+                {
+                    *out++ = 0xc0 | (run - 1);
+                    run = 0;
+                }
+
+                uint8_t r = p >> 16, g = p >> 8, b = p;
+                int h = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+                if (index[h] == p)
+                    *out++ = h;
+
+                else
+                {
+                    index[h] = p;
+
+                    int8_t dr    = r - uint8_t( prev >> 16);
+                    int8_t dg    = g - uint8_t( prev >> 8);
+                    int8_t db    = b - uint8_t( prev);
+                    int8_t dr_dg = dr - dg;
+                    int8_t db_dg = db - dg;
+
+                    if ((dr >= -2) and (dr <= 1) and (dg >= -2) and (dg <= 1) and
+                        (db >= -2) and (db <= 1))
+                        *out++ = 0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+
+                    else if ((dg >= -32) and (dg <= 31) and (dr_dg >= -8) and
+                             (dr_dg <= 7) and (db_dg >= -8) and (db_dg <= 7))
+                    {
+                        *out++ = 0x80 | (dg + 32);
+                        *out++ = (dr_dg + 8) << 4 | (db_dg + 8);
+                    }
+
+                    else
+                    {
+                        *out++ = 0xfe;
+                        *out++ = r;
+                        *out++ = g;
+                        *out++ = b;
+                    }
+                }
+                prev = p;
+            }
+        }
+
+        if (run > 0)
+            *out++ = 0xc0 | (run - 1);
+        body.resize( out - body.data());
+
+        tail = { 0, 0, 0, 0, 0, 0, 0, 1};
+    }
+
+
+
+    void RTR::image_writer::encode_png( const uint32_t* pixels, int width,
+                                        int height, int stride)
+    {
+        size_t row_bytes = 1 + 3 * size_t( width);
+        body.resize( row_bytes * height);
+        strips.resize( (height + PNG_STRIP_ROWS - 1) / PNG_STRIP_ROWS);
+
+        auto filter = [&]( size_t b, size_t e)
+        {
+            filter_rows( pixels, width, stride, b, e);
+        };
+        auto pack = [&]( size_t b, size_t e)
+        {
+            for (size_t k = b; k < e; k++)
+                deflate_strip( k, row_bytes, height);
+        };
+
+        // (a strip looks back into the rows of the one before)
+        if (workers)
+        {
+            workers->parallel_for( 0, height, PNG_STRIP_ROWS, filter);
+            workers->parallel_for( 0, strips.size(), 1, pack);
+        }
+        else
+        {
+            filter( 0, height);
+            pack( 0, strips.size());
+        }
+
+        // (FLEVEL of the zlib header: 1 fast, 2 default, 3 best)
+        uint8_t cmf = 0x78;
+        uint8_t flg = ((PNG_LEVEL < 2) ? 0 : (PNG_LEVEL < 6) ? 1 :
+                       (PNG_LEVEL == 6) ? 2 : 3) << 6;
+        flg += (31 - (cmf * 256 + flg) % 31) % 31;
+
+        size_t        idat  = 2 + 4;
+        unsigned long adler = adler32( 0, nullptr, 0);
+        for (size_t k = 0; k < strips.size(); k++)
+        {
+            size_t y0 = k * PNG_STRIP_ROWS;
+            size_t y1 = std::min<size_t>( y0 + PNG_STRIP_ROWS, height);
+            adler = adler32_combine( adler, strips[k].adler, (y1 - y0) * row_bytes);
+            idat += strips[k].data.size();
+        }
+
+        std::vector<uint8_t> ihdr;
+        put_be32( ihdr, width);
+        put_be32( ihdr, height);
+        ihdr.insert( ihdr.end(), { 8, 2, 0, 0, 0});     // 8 bit RGB
+
+        head = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        put_chunk( head, "IHDR", ihdr);
+        put_be32( head, idat);
+        size_t at = head.size();
+        head.insert( head.end(), { 'I', 'D', 'A', 'T', cmf, flg});
+
+        unsigned long crc = crc32( 0, head.data() + at, head.size() - at);
+        for (const strip& s : strips)
+            crc = crc32_combine( crc, s.crc, s.data.size());
+
+        tail.clear();
+        put_be32( tail, adler);
+        crc = crc32( crc, tail.data(), tail.size());
+        put_be32( tail, crc);
+        put_chunk( tail, "IEND", {});
+    }
+
+
+
+    // rows [y0, y1) into <body>, each with the filter
+    // of the smallest sum of its bytes taken as signed
+    void RTR::image_writer::filter_rows( const uint32_t* pixels, int width,
+                                         int stride, size_t y0, size_t y1)
+    {
+        size_t n = 3 * size_t( width);
+        std::vector<uint8_t> prev( n), cur( n), trial( n), best( n);
+
+        if (y0 > 0)
+            unpack_row( pixels + (y0 - 1) * stride, width, prev.data());
+
+        for (size_t y = y0; y < y1; y++)
+        {
+            unpack_row( pixels + y * stride, width, cur.data());
+
+            // (a filter is dropped as soon as it can't win)
+            uint8_t  best_type = 0;
+            uint64_t best_sum  = UINT64_MAX;
+            auto try_filter = [&]( uint8_t type, auto predict)
+            {
+                uint64_t sum = 0;
+                for (size_t i = 0; i < n; i++)
+                {
+                    int a = (i >= 3) ? cur[i - 3]  : 0;
+                    int c = (i >= 3) ? prev[i - 3] : 0;
+                    trial[i] = cur[i] - predict( a, prev[i], c);
+                    sum += std::abs( int8_t( trial[i]));
+                    if ((sum >= best_sum) and ((i & 63) == 63))
+                        return;
+                }
+
+                if (sum < best_sum)
+                {
+                    best_sum  = sum;
+                    best_type = type;
+                    std::swap( best, trial);
+                }
+            };
+
+            try_filter( 0, []( int, int, int)     { return 0; });
+            try_filter( 1, []( int a, int, int)   { return a; });
+            try_filter( 2, []( int, int b, int)   { return b; });
+            try_filter( 3, []( int a, int b, int) { return (a + b) / 2; });
+            try_filter( 4, []( int a, int b, int c) { return paeth( a, b, c); });
+
+            uint8_t* dst = body.data() + y * (n + 1);
+            dst[0] = best_type;
+            std::copy( best.begin(), best.end(), dst + 1);
+            std::swap( prev, cur);
+        }
+    }
+
+
+
+    void RTR::image_writer::deflate_strip( size_t k, size_t row_bytes,
+                                           size_t height)
+    {
+        size_t y0 = k * PNG_STRIP_ROWS;
+        size_t y1 = std::min<size_t>( y0 + PNG_STRIP_ROWS, height);
+        bool   last = (y1 == height);
+
+        const uint8_t* in   = body.data() + y0 * row_bytes;
+        size_t         len  = (y1 - y0) * row_bytes;
+        size_t         dict = std::min<size_t>( y0 * row_bytes, 32768);
+
+        z_stream z = {};
+        if (deflateInit2( &z, PNG_LEVEL, Z_DEFLATED, -15, 8,
+                          Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::runtime_error( "Can't start deflate");
+
+        if (dict > 0)
+            deflateSetDictionary( &z, in - dict, dict);
+
+        strip& s = strips[k];
+        s.data.resize( deflateBound( &z, len) + 64);
+        z.next_in  = const_cast<uint8_t*>( in);
+        z.avail_in = len;
+
+        // (the last strip ends the stream, the others byte align it)
+        size_t used = 0;
+        for (;;)
+        {
+            z.next_out  = s.data.data() + used;
+            z.avail_out = s.data.size() - used;
+            int ret = deflate( &z, last ? Z_FINISH : Z_SYNC_FLUSH);
+            used = s.data.size() - z.avail_out;
+
+            if (ret == Z_STREAM_ERROR)
+            {
+                deflateEnd( &z);
+                throw std::runtime_error( "Can't deflate");
+            }
+            if (last ? (ret == Z_STREAM_END) : (z.avail_out > 0))
+                break;
+
+            s.data.resize( 2 * s.data.size());
+        }
+        deflateEnd( &z);
+
+        s.data.resize( used);
+        s.adler = adler32( adler32( 0, nullptr, 0), in, len);
+        s.crc   = crc32( 0, s.data.data(), used);
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
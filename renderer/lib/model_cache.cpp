@@ -0,0 +1,91 @@
+#include "model_cache.hpp"
+
+#include <filesystem>
+#include <system_error>
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Constructor:
+//
+    RTR::model_cache::model_cache( size_t budget, asset_registry& assets)
+    : budget( budget), assets( assets)
+    {}
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Lookup:
+//
+    RTR::model_cache::model_ptr RTR::model_cache::get( const std::string& path)
+    {
+        // (one entry for the ways of naming the same file)
+        std::error_code ec;
+        std::string key = std::filesystem::weakly_canonical( path, ec).string();
+        if (ec)
+            key = path;
+
+        // (the registry looks for changes of the file, loads it if it has
+        // to and waits for a load of the same model already running)
+        model_ptr model = assets.model( key);
+
+        std::lock_guard<std::mutex> lock( m);
+        auto it = entries.find( key);
+        if ((it != entries.end()) and (it->second.model == model))
+        {
+            hits++;
+            lru.splice( lru.begin(), lru, it->second.lru);
+            return model;
+        }
+
+        misses++;
+        if (it != entries.end())    // (changed on disk)
+        {
+            bytes -= it->second.bytes;
+            lru.erase( it->second.lru);
+            entries.erase( it);
+        }
+
+        lru.push_front( key);
+        entries[ key] = entry{ model, model->bytes(), lru.begin()};
+        bytes += model->bytes();
+        evict();
+
+        return model;
+    }
+
+
+
+    // the least recently used models go
+    // until the rest fits the budget
+    void RTR::model_cache::evict()
+    {
+        while ((bytes > budget) and !lru.empty())
+        {
+            auto e = entries.find( lru.back());
+            bytes -= e->second.bytes;
+            entries.erase( e);
+            lru.pop_back();
+        }
+    }
+
+
+
+    RTR::model_cache::counters RTR::model_cache::stats() const
+    {
+        std::lock_guard<std::mutex> lock( m);
+
+        counters res;
+        res.hits    = hits;
+        res.misses  = misses;
+        res.models  = entries.size();
+        res.bytes   = bytes;
+        res.budget  = budget;
+        return res;
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
@@ -1,17 +1,22 @@
 //#include "primitives.hpp"
-#include "rtrenderer.hpp"
-void RTR::Window::draw_line( int x1, int y1, int x2, int y2)
+#include "renderer.hpp"
+
+// Every primitive touches only the pixels inside its screen_tile t
+// (the tiles of a frame are rasterized concurrently)
+void RTR::Renderer::draw_line( screen_tile& t, int x1, int y1, int x2, int y2)
 {
-    #ifdef USING_SDL
-        SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-    #else
+    // (nothing to do in this tile)
+    if ((std::max( x1, x2) < t.x0) or (std::min( x1, x2) >= t.x1) or
+        (std::max( y1, y2) < t.y0) or (std::min( y1, y2) >= t.y1))
+        return;
+
     if(x1 == x2)
     {
         if(y1 > y2)
             std::swap(y1, y2);
             
         for(int y = y1; y <= y2; ++y)
-            SDL_RenderDrawPoint(renderer, x1, y);
+            draw_point( t, x1, y);
         return;
     }
 
@@ -36,8 +41,8 @@ void RTR::Window::draw_line( int x1, int y1, int x2, int y2)
     for(int x = x1; x <= x2; ++x)
     {
         transposed
-            ? SDL_RenderDrawPoint(renderer, y, x)
-            : SDL_RenderDrawPoint(renderer, x, y);
+            ? draw_point( t, y, x)
+            : draw_point( t, x, y);
 
         error += derror;
         if(error > dx)
@@ -46,21 +51,87 @@ void RTR::Window::draw_line( int x1, int y1, int x2, int y2)
             error -= dx * 2;
         }
     }
-    #endif
 }
 
 
 
 
-void RTR::Window::draw_line( vec2i v1, vec2i v2)
+void RTR::Renderer::draw_line( screen_tile& t, vec2i v1, vec2i v2)
 {
-    draw_line( v1.x, v1.y, v2.x, v2.y);
+    draw_line( t, v1.x, v1.y, v2.x, v2.y);
+}
+
+
+
+// The pixels of draw_line() written straight into cbuf, clipped to the view
+// (other threads may draw crossing lines: all of one color, any store wins);
+// with <depths> given only the ones not behind them by more than
+// HIDDEN_LINE_BIAS, returns how many were written
+size_t RTR::Renderer::draw_edge( vec3i v1, vec3i v2, uint32_t color,
+                               const zbuf_depth_t* depths)
+{
+    bool transposed = (std::abs(v2.y - v1.y) > std::abs(v2.x - v1.x));
+    if(transposed)
+    {
+        std::swap(v1.x, v1.y);
+        std::swap(v2.x, v2.y);
+    }
+
+    if(v2.x < v1.x)
+        std::swap(v1, v2);
+
+    int xend = transposed ? VIEW_HEIGHT : VIEW_WIDTH;
+    int yend = transposed ? VIEW_WIDTH  : VIEW_HEIGHT;
+    if((v2.x < 0) or (v1.x >= xend))
+        return 0;
+
+    int64_t dx     = v2.x - v1.x;
+    int64_t dy     = v2.y - v1.y;
+    int64_t derror = std::abs(dy) * 2;
+    int     step   = (dy > 0) - (dy < 0);
+    double  dz     = dx ? (v2.z - v1.z) / (double) dx : 0;
+
+    // (the steps of y and the error draw_line() has at the first x in view)
+    int     xfirst = std::max(v1.x, 0);
+    int     xlast  = std::min(v2.x, xend - 1);
+    int64_t k      = xfirst - v1.x;
+    int64_t n      = dx ? (derror * k + dx - 1) / (2 * dx) : 0;
+    int64_t error  = derror * k - 2 * dx * n;
+    int64_t y      = v1.y + step * n;
+
+    size_t written = 0;
+    for(int x = xfirst; x <= xlast; ++x)
+    {
+        if((0 <= y) and (y < yend))
+        {
+            size_t i = transposed ? y + x * STRIDE : x + y * STRIDE;
+            if(!depths or
+               (v1.z + dz * (x - v1.x) + HIDDEN_LINE_BIAS >= depths[i]))
+            {
+                std::atomic_ref<uint32_t>(cbuf[i]).store(color,
+                                                     std::memory_order_relaxed);
+                written++;
+            }
+        }
+        // (gone out of the view for good)
+        else if((y < 0) ? (step <= 0) : (step >= 0))
+            break;
+
+        error += derror;
+        if(error > dx)
+        {
+            y += step;
+            error -= dx * 2;
+        }
+    }
+
+    return written;
 }
 
 
 
 // !!NO ZBUF!!
-void RTR::Window::draw_triangle( vec2i v1, vec2i v2, vec2i v3)
+void RTR::Renderer::draw_triangle( screen_tile& t, vec2i v1, vec2i v2, vec2i v3)
 {
     if((v1.y == v2.y) && (v1.y == v3.y)) return;
 
@@ -71,13 +142,14 @@ void RTR::Window::draw_triangle( vec2i v1, vec2i v2, vec2i v3)
     if(v2.y > v3.y)
         std::swap(v2, v3);
 
-    for(int y = v1.y; y < v3.y; ++y)
+    int yend = std::min( v3.y, t.y1);
+    for(int y = std::max( v1.y, t.y0); y < yend; ++y)
     {
         int x1 = v1.x + (y - v1.y) * (v3.x - v1.x) / (double) (v3.y - v1.y);
         int x2 = (y < v2.y)
             ? v1.x + (y - v1.y) * (v2.x - v1.x) / (double) (v2.y - v1.y)
             : v2.x + (y - v2.y) * (v3.x - v2.x) / (double) (v3.y - v2.y);
-        draw_line( x1, y, x2, y);
+        draw_line( t, x1, y, x2, y);
     }
 }
 
@@ -85,13 +157,14 @@ void RTR::Window::draw_triangle( vec2i v1, vec2i v2, vec2i v3)
 
 
 
-void RTR::Window::draw_triangle( vec3i v1, vec3i v2, vec3i v3)
+void RTR::Renderer::draw_triangle( screen_tile& t, vec3i v1, vec3i v2, vec3i v3)
 {
     if(v1.y > v2.y)        std::swap(v1, v2);
     if(v1.y > v3.y)        std::swap(v1, v3);
     if(v2.y > v3.y)        std::swap(v2, v3);
 
-    for( int y = v1.y; y < v3.y; ++y)
+    int yend = std::min( v3.y, t.y1);
+    for( int y = std::max( v1.y, t.y0); y < yend; ++y)
     {
         bool second = (y >= v2.y);
         double k1 = (y - v1.y) / (double) (v3.y - v1.y);
@@ -113,27 +186,28 @@ void RTR::Window::draw_triangle( vec3i v1, vec3i v2, vec3i v3)
             
 
         // needed for z buffer interpolation 
-        double phi;
+        double phi = 0;
         if (compound.x - whole.x)
             phi = (compound.z - whole.z) /
                                 (double) (compound.x - whole.x);
 
  
-        for (int x = (int) whole.x; x <= (int) compound.x; ++x)
+        int xend = std::min( (int) compound.x, t.x1 - 1);
+        for (int x = std::max( (int) whole.x, t.x0); x <= xend; ++x)
         {
             zbuf_depth_t z = static_cast<zbuf_depth_t>(
                                 whole.z + phi * (x - whole.x));
                                 
-            size_t i = x + y * WIN_WIDTH;
+            size_t i = x + y * STRIDE;
 
-            if ((0 < x) and (x < WIN_WIDTH) and (0 < y) and (y < WIN_HEIGHT))
+            if ((0 < x) and (x < BUF_WIDTH) and (0 < y) and (y < BUF_HEIGHT))
             {
-                if (zbuf_min > z) zbuf_min = z;
-                if (zbuf_max < z) zbuf_max = z;
-                if( zbuf[i] < z)  
+                t.stats.depth_tests++;
+                if( t.zbuf[i] < z)  
                 {
-                    zbuf[i] = z;
-                    SDL_RenderDrawPoint(renderer, x, y);
+                    t.stats.depth_writes++;
+                    t.zbuf[i] = z;
+                    t.cbuf[i] = t.color;
                 }
             }
         }
@@ -149,8 +223,66 @@ void RTR::Window::draw_triangle( vec3i v1, vec3i v2, vec3i v3)
 
 
 
+// depth prepass: the same scanlines as the textured triangle below
+// (so that both passes get bit-equal z) but nothing is drawn
+// (VISBUF also keeps the id of the face that won the pixel)
+void RTR::Renderer::only_fill_zbuf( screen_tile& t, vec3i v1, vec3i v2, vec3i v3,
+                                  uint32_t id)
+{
+    if(v1.y > v2.y)        std::swap(v1, v2);
+    if(v1.y > v3.y)        std::swap(v1, v3);
+    if(v2.y > v3.y)        std::swap(v2, v3);
+
+    int yend = std::min( v3.y, t.y1);
+    for(int y = std::max( v1.y, t.y0); y < yend; ++y)
+    {
+        bool second = (y >= v2.y);
+        double k1 = (y - v1.y) / (double) (v3.y - v1.y);
+        double k2 = (second)
+            ? (y - v2.y) / (double) (v3.y - v2.y)
+            : (y - v1.y) / (double) (v2.y - v1.y);
+
+        vec3d whole = vec3d(v1) + vec3d(v3 - v1) * k1;
+        vec3d compound = second
+                                ? vec3d(v2) + vec3d(v3 - v2) * k2
+                                : vec3d(v1) + vec3d(v2 - v1) * k2;
+
+        if (whole.x > compound.x)
+            std::swap(whole, compound);
+
+        double phi1 = 0;
+        if ((compound.x - whole.x) >= 1)
+            phi1 = (compound.z - whole.z) / 
+                            (double) (compound.x - whole.x);
+
+        for(int x = std::max<int>( whole.x, t.x0);
+                (x <= compound.x) and (x < t.x1); ++x)
+        {
+            zbuf_depth_t z = static_cast<zbuf_depth_t>(
+                                whole.z + phi1 * (int) (x - whole.x));
+
+            size_t i = x + y * STRIDE;
+
+            t.stats.depth_tests++;
+            if (t.zbuf[i] < z)
+            {
+                t.stats.depth_writes++;
+                t.zbuf[i] = z;
+                if (id)
+                    t.vbuf[i] = id;
+            }
+        }
+    }
+}
+
+
+
+
+
 // textures the triangle
-void RTR::Window::draw_triangle(    vec3i v1, vec3i v2, vec3i v3,
+// (after only_fill_zbuf() shades only the pixels that kept its depth)
+void RTR::Renderer::draw_triangle(    screen_tile& t,
+                                    vec3i v1, vec3i v2, vec3i v3,
                                     vec2i t1, vec2i t2, vec2i t3, 
                                     double intensity)
 {
@@ -171,7 +303,8 @@ void RTR::Window::draw_triangle(    vec3i v1, vec3i v2, vec3i v3,
     }
 
 
-    for(int y = v1.y; y < v3.y; ++y)
+    int yend = std::min( v3.y, t.y1);
+    for(int y = std::max( v1.y, t.y0); y < yend; ++y)
     {
         bool second = (y >= v2.y);
         double k1 = (y - v1.y) / (double) (v3.y - v1.y);
@@ -198,7 +331,7 @@ void RTR::Window::draw_triangle(    vec3i v1, vec3i v2, vec3i v3,
 
 
 
-        double phi1, phi2, phi3;
+        double phi1 = 0, phi2 = 0, phi3 = 0;
         // avoiding deletion on zero after (double) cast
         if ((compound.x - whole.x) >= 1)
         {
@@ -212,38 +345,52 @@ void RTR::Window::draw_triangle(    vec3i v1, vec3i v2, vec3i v3,
                                 (double) (compound.x - whole.x);
         }
 
-        for(int x = whole.x; x <= compound.x; ++x)
+        for(int x = std::max<int>( whole.x, t.x0);
+                (x <= compound.x) and (x < t.x1); ++x)
         {
             zbuf_depth_t z = static_cast<zbuf_depth_t>(
                                 whole.z + phi1 * (int) (x - whole.x));
 
-            int t_1 = t_whole[0] + phi2 * (int) (x - whole.x);
-            int t_2 = t_whole[1] + phi3 * (int) (x - whole.x);
+            double t_1 = t_whole[0] + phi2 * (int) (x - whole.x);
+            double t_2 = t_whole[1] + phi3 * (int) (x - whole.x);
 
-            size_t i = x + y * WIN_WIDTH;
+            size_t i = x + y * STRIDE;
 
-            if (i < static_cast<size_t>(WIN_WIDTH * WIN_HEIGHT))
+            bool visible;
+            if (depth_prepass)
+            {
+                // the first face with the final depth wins
+                // just like with the strict test below
+                visible = (t.zbuf[i] == z) and !zbuf_shaded[i];
+                if (visible)
+                    zbuf_shaded[i] = true;
+            }
+            else
             {
-                if (zbuf_min > z) zbuf_min = z;
-                if (zbuf_max < z) zbuf_max = z;
-                if (zbuf[i]  < z)
+                t.stats.depth_tests++;
+                visible = (t.zbuf[i] < z);
+                if (visible)
                 {
-                    zbuf[i] = z;
-                    
-                    SDL_Color clr = model.tv_clr( t_1, t_2);
-
-                    uint8_t r = clr.r * intensity;
-                    uint8_t g = clr.g * intensity;
-                    uint8_t b = clr.b * intensity;
-                    uint8_t a = clr.a * intensity;
-
-                    SDL_SetRenderDrawColor( renderer, r, g, b, a);
-                        
-                    SDL_RenderDrawPoint(renderer, x, y);
-
-
+                    t.stats.depth_writes++;
+                    t.zbuf[i] = z;
                 }
             }
+
+            if (visible)
+            {
+                t.stats.texel_fetches++;
+                color clr = filter_textures
+                                ? filtered_texel( t_1, t_2)
+                                : model.tv_clr( static_cast<int>( t_1),
+                                                static_cast<int>( t_2));
+
+                uint8_t r = clr.r * intensity;
+                uint8_t g = clr.g * intensity;
+                uint8_t b = clr.b * intensity;
+                uint8_t a = clr.a * intensity;
+
+                t.cbuf[i] = pack_color( r, g, b, a);
+            }
         }
     }
 }
@@ -257,4 +404,3 @@ void RTR::Window::draw_triangle(    vec3i v1, vec3i v2, vec3i v3,
 
 
 
-
@@ -0,0 +1,526 @@
+#include "render_server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define RENDER_SERVER_SOCKETS 1
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0      // (SIGPIPE is up to the program then)
+#endif
+#endif
+
+
+namespace
+{
+    double ms_since( std::chrono::steady_clock::time_point t0)
+    {
+        return std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0).count();
+    }
+
+    // the smallest of <v> that <p> of them do not exceed
+    double percentile( std::vector<double> v, double p)
+    {
+        if (v.empty())
+            return 0;
+
+        size_t k = std::min( v.size() - 1,
+                             size_t( std::max( 1., std::ceil( p * v.size()))) - 1);
+        std::nth_element( v.begin(), v.begin() + k, v.end());
+        return v[k];
+    }
+
+    // (an answer is a single line)
+    std::string one_line( std::string s)
+    {
+        std::replace( s.begin(), s.end(), '\n', ' ');
+        return s;
+    }
+
+    const char* format_name( RTR::image_writer::format_t f)
+    {
+        switch (f)
+        {
+            case RTR::image_writer::QOI : return "qoi";
+            case RTR::image_writer::PNG : return "png";
+            default                     : return "ppm";
+        }
+    }
+
+#ifdef RENDER_SERVER_SOCKETS
+    bool send_all( int fd, const void* data, size_t size)
+    {
+        const char* p = static_cast<const char*>( data);
+        while (size > 0)
+        {
+            ssize_t n = ::send( fd, p, size, MSG_NOSIGNAL);
+            if ((n < 0) and (errno == EINTR))
+                continue;
+            if (n <= 0)
+                return false;
+
+            p    += n;
+            size -= n;
+        }
+
+        return true;
+    }
+
+    [[noreturn]] void socket_failure( const std::string& what, const std::string& path)
+    {
+        throw std::runtime_error( what + " socket " + path + ": " +
+                                  std::strerror( errno));
+    }
+#endif
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Constructor/Destructor:
+//
+    RTR::render_server::render_server( const server_options& options,
+                                       scheduler& workers)
+    : options( options), workers( workers), cache( options.cache_bytes)
+    {
+        if ((options.renders == 0) or (options.max_queue == 0))
+            throw std::invalid_argument( "A server needs a render and a queue");
+
+    #ifdef RENDER_SERVER_SOCKETS
+        if (::pipe( wake_fd) != 0)
+            throw std::runtime_error( std::string( "Can't create a pipe: ") +
+                                      std::strerror( errno));
+    #endif
+    }
+
+
+
+    RTR::render_server::~render_server()
+    {
+    #ifdef RENDER_SERVER_SOCKETS
+        for (int fd : wake_fd)
+            if (fd >= 0)
+                ::close( fd);
+    #endif
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Requests:
+//
+    RTR::render_request RTR::render_server::parse_request( const std::string& args)
+    {
+        std::istringstream is( args);
+        std::string mode, size, format;
+        render_request r;
+
+        if (!(is >> mode >> size >> format >> r.orientation.w >> r.orientation.x
+                 >> r.orientation.y >> r.orientation.z))
+            throw std::invalid_argument( "bad request");
+
+        r.mode = mode_by_name( mode);
+        if (r.mode == null)
+            throw std::invalid_argument( "no mode " + mode);
+
+        char end = 0;
+        if ((std::sscanf( size.c_str(), "%dx%d%c", &r.width, &r.height, &end) != 2) or
+            (r.width <= 0) or (r.height <= 0) or
+            (r.width > SERVER_MAX_SIDE) or (r.height > SERVER_MAX_SIDE))
+            throw std::invalid_argument( "bad size " + size);
+
+        if (format == "ppm")
+            r.format = image_writer::PPM;
+        else if (format == "qoi")
+            r.format = image_writer::QOI;
+        else if (format == "png")
+            r.format = image_writer::PNG;
+        else
+            throw std::invalid_argument( "no format " + format);
+
+        if (!(r.orientation.norm() > 0))
+            throw std::invalid_argument( "bad orientation");
+        r.orientation.normalize();
+
+        // (the rest of the line, spaces and all)
+        std::getline( is >> std::ws, r.model);
+        if (r.model.empty())
+            throw std::invalid_argument( "no model");
+
+        return r;
+    }
+
+
+
+    // Connection thread: a request is queued and waited for,
+    // then answered
+    std::string RTR::render_server::answer( const std::string& line,
+                                            std::vector<uint8_t>& body)
+    {
+        body.clear();
+
+        std::string word = line.substr( 0, line.find( ' '));
+        if (word == "stats")
+        {
+            std::string s = stats() + "\n";
+            body.assign( s.begin(), s.end());
+            return "ok " + std::to_string( body.size()) + "\n";
+        }
+
+        if (word != "render")
+            return "error unknown request " + one_line( word) + "\n";
+
+        job j;
+        try
+        {
+            j.request = parse_request( line.substr( word.size()));
+        }
+        catch (std::exception& e)
+        {
+            return "error " + one_line( e.what()) + "\n";
+        }
+
+        {
+            std::unique_lock<std::mutex> lock( m);
+            if (stopping or (queue.size() >= options.max_queue))
+            {
+                refused++;
+                return "error busy\n";
+            }
+
+            j.queued = std::chrono::steady_clock::now();
+            queue.push_back( &j);
+            queue_max = std::max( queue_max, queue.size());
+            queue_cv.notify_one();
+
+            done_cv.wait( lock, [&] { return j.done; });
+        }
+
+        if (!j.error.empty())
+            return "error " + one_line( j.error) + "\n";
+
+        body.swap( j.image);
+        return "ok " + std::to_string( body.size()) + "\n";
+    }
+
+
+
+    // Render thread: the jobs in turn, until the server stops
+    // and the queue is empty
+    void RTR::render_server::render_loop()
+    {
+        render_slot slot;
+        for (;;)
+        {
+            job* j;
+            {
+                std::unique_lock<std::mutex> lock( m);
+                queue_cv.wait( lock, [&] { return stopping or !queue.empty(); });
+                if (queue.empty())
+                    return;
+
+                j = queue.front();
+                queue.pop_front();
+            }
+
+            double waited = ms_since( j->queued);
+            try
+            {
+                render_job( slot, *j);
+            }
+            catch (std::exception& e)
+            {
+                j->error = e.what();
+            }
+            catch (...)
+            {
+                j->error = "unknown exception";
+            }
+
+            double ms = ms_since( j->queued);
+            {
+                std::lock_guard<std::mutex> lock( m);
+                if (j->error.empty())
+                {
+                    served++;
+                    if (latencies.size() < SERVER_LATENCIES)
+                        latencies.push_back( ms);
+                    else
+                        latencies[ latency_next] = ms;
+                    latency_next = (latency_next + 1) % SERVER_LATENCIES;
+                }
+                else
+                    failed++;
+
+                if (options.verbose)
+                    std::cout << "render " << j->request.width << "x"
+                              << j->request.height << " "
+                              << format_name( j->request.format) << " "
+                              << j->request.model << ": " << ms << " ms"
+                              << " (queued " << waited << " ms)"
+                              << (j->error.empty() ? "" : "\terror: ")
+                              << j->error << std::endl;
+
+                j->done = true;
+            }
+            done_cv.notify_all();
+        }
+    }
+
+
+
+    // the renderer of the slot is kept as long as the model and the size are
+    void RTR::render_server::render_job( render_slot& slot, job& j)
+    {
+        const render_request& r = j.request;
+
+        model_cache::model_ptr model = cache.get( r.model);
+
+        if ((slot.model != model) or !slot.core or
+            (slot.core->width() != r.width) or (slot.core->height() != r.height))
+        {
+            slot.core.reset();
+            slot.model = model;
+            slot.core  = std::make_unique<Renderer>( *model, r.width, r.height,
+                                                     workers);
+            slot.pixels.assign( size_t( r.width) * r.height, 0);
+            slot.dirty = { 0, 0, r.width, r.height};
+        }
+
+        view_state v;
+        v.mode          = r.mode;
+        v.orientation   = r.orientation;
+        v.W_SHIFT       = W_SHIFT_DEFAULT;
+        v.H_SHIFT       = H_SHIFT_DEFAULT;
+        v.D_SHIFT       = D_SHIFT_DEFAULT;
+        slot.core->render( v, { slot.pixels.data(), nullptr, r.width, &slot.dirty});
+
+        std::unique_ptr<image_writer>& writer = slot.writers[ r.format];
+        if (!writer)
+            writer = std::make_unique<image_writer>( r.format, &workers);
+        writer->encode( slot.pixels.data(), r.width, r.height, r.width, j.image);
+    }
+
+
+
+    std::string RTR::render_server::stats() const
+    {
+        model_cache::counters c = cache.stats();
+
+        std::vector<double> ms;
+        size_t depth, depth_max, ok, bad, busy;
+        {
+            std::lock_guard<std::mutex> lock( m);
+            ms        = latencies;
+            depth     = queue.size();
+            depth_max = queue_max;
+            ok        = served;
+            bad       = failed;
+            busy      = refused;
+        }
+
+        size_t lookups = c.hits + c.misses;
+        std::ostringstream os;
+        os << "queue: "      << depth << " (max " << depth_max << ")"
+           << "\tcache: "    << c.models << " models, " << (c.bytes >> 20)
+                             << " of " << (c.budget >> 20) << " MiB"
+           << "\thit rate: " << (lookups ? 100. * c.hits / lookups : 0) << "%"
+                             << " (" << c.hits << "/" << lookups << ")"
+           << "\tlatency p50: " << percentile( ms, 0.5)  << " ms"
+           << "\tp99: "      << percentile( ms, 0.99) << " ms"
+           << "\tserved: "   << ok
+           << "\tfailed: "   << bad
+           << "\trefused: "  << busy;
+        return os.str();
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Socket:
+//
+    void RTR::render_server::run()
+    {
+    #ifdef RENDER_SERVER_SOCKETS
+        const std::string& path = options.socket_path;
+
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.empty() or (path.size() >= sizeof( addr.sun_path)))
+            throw std::invalid_argument( "Bad socket path " + path);
+        std::memcpy( addr.sun_path, path.c_str(), path.size());
+
+        // (a socket left behind by a server that crashed is replaced)
+        struct stat st;
+        if ((::lstat( path.c_str(), &st) == 0) and S_ISSOCK( st.st_mode))
+            ::unlink( path.c_str());
+
+        listen_fd = ::socket( AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+            socket_failure( "Can't create", path);
+
+        if ((::bind( listen_fd, reinterpret_cast<sockaddr*>( &addr), sizeof( addr)) != 0) or
+            (::listen( listen_fd, SOMAXCONN) != 0))
+        {
+            ::close( listen_fd);
+            listen_fd = -1;
+            socket_failure( "Can't listen on", path);
+        }
+
+        stopping = false;
+        for (size_t k = 0; k < options.renders; k++)
+            renders.emplace_back( &RTR::render_server::render_loop, this);
+
+        for (;;)
+        {
+            pollfd fds[2] = { { listen_fd, POLLIN, 0}, { wake_fd[0], POLLIN, 0} };
+            if (::poll( fds, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+
+            if (fds[1].revents)
+            {
+                char c;
+                ssize_t n = ::read( wake_fd[0], &c, 1);
+                (void) n;
+                break;
+            }
+
+            if (fds[0].revents & POLLIN)
+            {
+                int fd = ::accept( listen_fd, nullptr, nullptr);
+                if (fd < 0)
+                    continue;
+
+                reap_connections( false);
+                connection& c = connections.emplace_back();
+                c.fd     = fd;
+                c.thread = std::thread( &RTR::render_server::serve, this, std::ref( c));
+            }
+        }
+
+        ::close( listen_fd);
+        listen_fd = -1;
+        ::unlink( path.c_str());
+
+        // the requests already queued are answered, no new ones
+        {
+            std::lock_guard<std::mutex> lock( m);
+            stopping = true;
+        }
+        reap_connections( true);
+
+        queue_cv.notify_all();
+        for (std::thread& t : renders)
+            t.join();
+        renders.clear();
+    #else
+        throw std::runtime_error( "No Unix domain sockets on this platform");
+    #endif
+    }
+
+
+
+    void RTR::render_server::stop()
+    {
+    #ifdef RENDER_SERVER_SOCKETS
+        char c = 0;
+        ssize_t n = ::write( wake_fd[1], &c, 1);
+        (void) n;
+    #endif
+    }
+
+
+
+    // Connection thread: requests, one a line, answered in turn
+    void RTR::render_server::serve( connection& c)
+    {
+    #ifdef RENDER_SERVER_SOCKETS
+        std::string             pending;
+        std::vector<uint8_t>    body;
+        char                    buf[4096];
+
+        for (bool open = true; open;)
+        {
+            ssize_t n = ::recv( c.fd, buf, sizeof( buf), 0);
+            if ((n < 0) and (errno == EINTR))
+                continue;
+            if (n <= 0)
+                break;
+
+            pending.append( buf, n);
+            for (size_t end; open and ((end = pending.find( '\n')) != std::string::npos);)
+            {
+                std::string line = pending.substr( 0, end);
+                pending.erase( 0, end + 1);
+                if (!line.empty() and (line.back() == '\r'))
+                    line.pop_back();
+                if (line.empty())
+                    continue;
+
+                std::string head = answer( line, body);
+                open = send_all( c.fd, head.data(), head.size()) and
+                       send_all( c.fd, body.data(), body.size());
+            }
+
+            if (open and (pending.size() > SERVER_MAX_LINE))
+            {
+                std::string head = "error request too long\n";
+                send_all( c.fd, head.data(), head.size());
+                break;
+            }
+        }
+    #endif
+
+        c.finished = true;
+    }
+
+
+
+    // joins the connections that are done (or, with <all>,
+    // ends the rest first)
+    void RTR::render_server::reap_connections( bool all)
+    {
+    #ifdef RENDER_SERVER_SOCKETS
+        for (auto it = connections.begin(); it != connections.end();)
+        {
+            if (all)
+                ::shutdown( it->fd, SHUT_RD);
+
+            if (!all and !it->finished)
+            {
+                ++it;
+                continue;
+            }
+
+            it->thread.join();
+            ::close( it->fd);
+            it = connections.erase( it);
+        }
+    #endif
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,2033 @@
+
+#include "renderer.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Modes:
+//
+    RTR::mode_t RTR::mode_by_name( const std::string& name)
+    {
+        static const std::pair<const char*, mode_t> names[] =
+        {
+            { "wire",           WIREFRAME   },
+            { "dont_remove",    N_RM_RST    },
+            { "rand",           RAND        },
+            { "rasterize",      RAST        },
+            { "texture",        TEXTURE     },
+            { "zbuf",           ZBUF        },
+            { "visbuf",         VISBUF      },
+            { "hidden",         HIDDEN_LINE },
+        };
+
+        for (auto& n : names)
+            if (name == n.first)
+                return n.second;
+
+        return null;
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+// Basic methods:
+///////////////////////////////////////////////////////////////////////////
+//  Constructor:
+//
+    RTR::Renderer::Renderer( const obj_model& model, int width, int height,
+                             scheduler& workers, int stride)
+    : model( model),
+      BUF_WIDTH( width), BUF_HEIGHT( height),
+      STRIDE( stride ? stride : width),
+      workers( &workers)
+    {
+        if ((BUF_WIDTH <= 0) or (BUF_HEIGHT <= 0) or (STRIDE < BUF_WIDTH))
+            throw std::invalid_argument( "Bad buffer size");
+
+        // (the model keeps its share of the buffer)
+        OBJ_SCALE = OBJ_SCALE_DEFAULT * BUF_HEIGHT / OBJ_SCALE_HEIGHT;
+
+        own_zbuf.resize( STRIDE * BUF_HEIGHT);
+        zbuf = own_zbuf.data();
+            zbuf_clear( { 0, 0, BUF_WIDTH, BUF_HEIGHT});
+
+        vbuf_data.resize( STRIDE * BUF_HEIGHT);
+        vbuf = vbuf_data.data();
+
+        for (int y = 0; y < BUF_HEIGHT; y += TILE_SIZE)
+            for (int x = 0; x < BUF_WIDTH; x += TILE_SIZE)
+            {
+                screen_tile t = whole_screen();
+                t.x0 = x;
+                t.y0 = y;
+                t.x1 = std::min( x + TILE_SIZE, BUF_WIDTH);
+                t.y1 = std::min( y + TILE_SIZE, BUF_HEIGHT);
+                tiles.push_back( t);
+            }
+
+        // a few chunks per worker keep binning balanced
+        bin_chunks = 4 * workers.size();
+        bins.resize( bin_chunks * tiles.size());
+        zbuf_shaded.resize( STRIDE * BUF_HEIGHT);
+
+        // (private buffers are allocated on the first sort-last frame)
+        parts.assign( workers.size(), whole_screen());
+        part_zbuf.resize( parts.size());
+        part_cbuf.resize( parts.size());
+        part_vbuf.resize( parts.size());
+
+        set_resolution( 1.);
+
+        return;
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Frames:
+//
+    const RTR::frame_stats& RTR::Renderer::render( const view_state& view,
+                                                   const render_target& target)
+    {
+        if ((target.color == nullptr) or
+            ((target.stride != 0) and (target.stride != STRIDE)))
+            throw std::invalid_argument( "Render target does not fit the buffers");
+
+        if (((view.mode == TEXTURE) or (view.mode == VISBUF)) and
+            !model.has_texture())
+            throw no_texture();
+
+        apply_view( view);
+        set_target( target);
+        clear_screen();
+
+        switch( mode)
+        {
+            case N_RM_RST:
+            case WIREFRAME:
+            case ZBUF:
+            case RAST:
+            case RAND:
+            case TEXTURE:
+            case VISBUF:
+            case HIDDEN_LINE:
+                            render_mode_threaded();
+                            break;
+
+
+            case TRIANGLE:  render_triangles();
+                            break;
+
+            case GOLD:      render_lines();
+                            break;
+
+            case NOT_GOLD:  render_lines();
+                            break;
+
+
+            default:        throw bad_mode();
+        }
+
+        return stats;
+    }
+
+
+
+    RTR::view_state RTR::Renderer::current_view() const
+    {
+        view_state v;
+        v.mode              = mode;
+        v.orientation       = orientation;
+        v.W_SHIFT           = W_SHIFT;
+        v.H_SHIFT           = H_SHIFT;
+        v.D_SHIFT           = D_SHIFT;
+        v.depth_prepass     = depth_prepass;
+        v.front_to_back     = front_to_back;
+        v.backface_culling  = backface_culling;
+        v.sort_last         = sort_last;
+        v.reproject         = reproject;
+        return v;
+    }
+
+
+
+    // (progressive refinement is up to the caller, see set_sample())
+    void RTR::Renderer::apply_view( const view_state& v)
+    {
+        mode                = v.mode;
+        orientation         = v.orientation;
+        W_SHIFT             = v.W_SHIFT;
+        H_SHIFT             = v.H_SHIFT;
+        D_SHIFT             = v.D_SHIFT;
+        depth_prepass       = v.depth_prepass;
+        front_to_back       = v.front_to_back;
+        backface_culling    = v.backface_culling;
+        sort_last           = v.sort_last;
+        reproject           = v.reproject;
+    }
+
+
+
+    // the buffers the next frame is drawn into;
+    // nothing is known of the depths of a new depth buffer,
+    // so all of them are cleared by the frame
+    void RTR::Renderer::set_target( const render_target& target)
+    {
+        zbuf_depth_t* depth = target.depth ? target.depth : own_zbuf.data();
+        if (depth != zbuf)
+        {
+            zbuf       = depth;
+            zbuf_dirty = { 0, 0, BUF_WIDTH, BUF_HEIGHT};
+            for (screen_tile& t : tiles)
+                t.zbuf = depth;
+            parts[0].zbuf = depth;
+        }
+
+        cbuf       = target.color;
+        cbuf_dirty = target.dirty;
+        for (screen_tile& t : tiles)
+            t.cbuf = cbuf;
+        parts[0].cbuf = cbuf;
+    }
+
+
+
+    // Render resolution: <scale> of the buffer side
+    // (the buffers keep their size, only the drawn corner changes)
+    void RTR::Renderer::set_resolution( double scale)
+    {
+        scale = std::clamp( scale, RES_SCALE_MIN, 1.);
+
+        int w = static_cast<int>( BUF_WIDTH * scale / RES_ALIGN + 0.5) * RES_ALIGN;
+        VIEW_WIDTH  = std::clamp( w, RES_ALIGN, BUF_WIDTH);
+        view_scale  = VIEW_WIDTH / static_cast<double>( BUF_WIDTH);
+        VIEW_HEIGHT = std::clamp( static_cast<int>( std::lround( BUF_HEIGHT * view_scale)),
+                                  1, BUF_HEIGHT);
+
+        // tiles keep their place, the ones outside are empty
+        for (screen_tile& t : tiles)
+        {
+            t.x1 = std::max( t.x0, std::min( t.x0 + TILE_SIZE, VIEW_WIDTH));
+            t.y1 = std::max( t.y0, std::min( t.y0 + TILE_SIZE, VIEW_HEIGHT));
+        }
+
+        for (screen_tile& t : parts)
+        {
+            t.x1 = VIEW_WIDTH;
+            t.y1 = VIEW_HEIGHT;
+        }
+    }
+
+
+
+    void RTR::Renderer::set_sample( double jx, double jy, bool filter)
+    {
+        jitter_x        = jx;
+        jitter_y        = jy;
+        filter_textures = filter;
+    }
+
+
+
+    // Supersampling: adds the sample just drawn to the sums
+    // and puts their average into the color buffer
+    // (<samples> counts it too)
+    void RTR::Renderer::accumulate( size_t samples)
+    {
+        accum.resize( 4 * STRIDE * BUF_HEIGHT);
+
+        // the jitter moves the samples by less than a pixel,
+        // elsewhere all of them are background
+        if (samples == 1)
+            accum_rect = screen_rect{ drawn.x0 - 2, drawn.y0 - 2,
+                                      drawn.x1 + 2, drawn.y1 + 2}
+                                .clip( VIEW_WIDTH, VIEW_HEIGHT);
+
+        const screen_rect& r = accum_rect;
+        workers->parallel_for( r.y0, r.y1, TILE_SIZE / 4,
+                               [&]( size_t b, size_t e)
+        {
+            for (size_t y = b; y < e; y++)
+                for (int x = r.x0; x < r.x1; x++)
+                {
+                    size_t      i = x + y * STRIDE;
+                    uint16_t*   s = &accum[4 * i];
+                    uint32_t    c = cbuf[i];
+
+                    for (int ch = 0; ch < 4; ch++)
+                    {
+                        uint16_t v = (c >> (8 * ch)) & 0xff;
+                        s[ch] = (samples == 1) ? v : s[ch] + v;
+                    }
+
+                    cbuf[i] = 0;
+                    for (int ch = 0; ch < 4; ch++)
+                        cbuf[i] |= uint32_t( (s[ch] + samples / 2) / samples)
+                                        << (8 * ch);
+                }
+        });
+
+        if (cbuf_dirty)
+            cbuf_dirty->unite( accum_rect);
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+//  Rendering stuff:
+// Object display mode handler
+// Supports all the modes
+//
+// A frame is a task graph run by the work-stealing scheduler:
+// transform (cluster chunks) -> order -> bin -> raster (tiles) -> resolve
+// or, sort-last, transform -> order -> raster (face ranges) -> composite
+// -> resolve; a reprojected frame warps the history before the tiles
+void RTR::Renderer::render_mode_threaded()
+{
+
+    // (the tiles clear the depths of the last frame on first touch)
+    zbuf_stale = zbuf_dirty;
+    zbuf_dirty = screen_rect();
+    stats = frame_stats();
+    stats.bytes_cleared = bytes_cleared;
+    bytes_cleared = 0;
+    frame_number++;
+
+    // (the scheduler may be drawing the frames of other renderers too)
+    work.reset();
+    scheduler::tally_scope counting( work);
+
+    stats.res_scale     = view_scale;
+
+    vec3d light(-1.0, .0, -1.0);
+    light.normalize();
+
+    lod = select_lod();
+    stats.lod = lod;
+
+    size_t nfaces = model.nfaces( lod);
+    stats.faces = nfaces;
+    projected.resize( nfaces);
+
+    // (hidden edges are still drawn in WIREFRAME,
+    //  HIDDEN_LINE never draws the ones of back faces)
+    cull_backfaces = (backface_culling and (mode != WIREFRAME)) or
+                     (mode == HIDDEN_LINE);
+
+    const auto& clusters = model.face_clusters( lod);
+    stats.clusters = clusters.size();
+
+    // sort-last needs nothing but a strict depth test
+    // (painter's modes and the prepass depend on submission order,
+    //  the hidden lines are tested against the depths of the tiles)
+    bool composited = sort_last and (mode != N_RM_RST) and
+                      (mode != WIREFRAME) and (mode != HIDDEN_LINE) and
+                      !((mode == TEXTURE) and depth_prepass);
+    const auto& raster_targets = composited ? parts : tiles;
+
+    reproject_frame = !composited and reprojectable();
+    if (reproject_frame)
+    {
+        reproj_count++;
+        warp_boxes.resize( tiles.size());
+        warp_pos.resize( STRIDE * BUF_HEIGHT);
+        warp_z.resize( STRIDE * BUF_HEIGHT);
+    }
+
+    draw_boxes.assign( (clusters.size() + CLUSTER_GRAIN - 1) / CLUSTER_GRAIN,
+                       screen_rect());
+
+    std::atomic<size_t> culled{0};
+    std::chrono::steady_clock::time_point t1;
+
+    task_graph frame;
+
+
+    // Submission order:
+    // (painter's N_RM_RST and WIREFRAME have no depth test to help)
+    auto order = frame.add( [&]
+    {
+        // (and the part of the view the faces cover)
+        drawn = screen_rect();
+        for (const screen_rect& r : draw_boxes)
+            drawn.unite( r);
+        drawn = drawn.clip( VIEW_WIDTH, VIEW_HEIGHT);
+
+        auto t0 = std::chrono::steady_clock::now();
+        if (front_to_back and (mode != N_RM_RST) and (mode != WIREFRAME))
+            sort_front_to_back();
+        else
+        {
+            draw_order.resize( nfaces);
+            std::iota( draw_order.begin(), draw_order.end(), 0);
+        }
+        t1 = std::chrono::steady_clock::now();
+        stats.sort_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    });
+
+
+    // Transform: a few clusters per task, culled ones are cheap
+    for (size_t k = 0; k < clusters.size(); k += CLUSTER_GRAIN)
+    {
+        auto transform = frame.add( [&, k]
+        {
+            size_t n = 0;
+            project_clusters( k, std::min( k + CLUSTER_GRAIN, clusters.size()),
+                              light, n, draw_boxes[k / CLUSTER_GRAIN]);
+            culled += n;
+        });
+        frame.precede( transform, order);
+    }
+
+
+    // Resolve: counters, then whatever needs the whole frame
+    auto resolve = frame.add( [&]
+    {
+        for (const screen_tile& t : raster_targets)
+        {
+            stats.depth_tests   += t.stats.depth_tests;
+            stats.depth_writes  += t.stats.depth_writes;
+            stats.texel_fetches += t.stats.texel_fetches;
+            stats.tiles_redrawn += t.stats.tiles_redrawn;
+            stats.tiles         += (t.x0 < t.x1) and (t.y0 < t.y1);
+            stats.bytes_cleared += t.stats.bytes_cleared;
+        }
+
+        // (warped pixels may land a little off the faces)
+        if (reproject_frame)
+            for (const std::array<int, 4>& b : warp_boxes)
+                drawn.unite( { b[0], b[1], b[2] + 1, b[3] + 1});
+
+        // VISBUF shading: each visible pixel once
+        if (mode == VISBUF)
+        {
+            std::atomic<size_t> fetches{0};
+            workers->parallel_for( drawn.y0, drawn.y1, TILE_SIZE / 4,
+                                  [&]( size_t b, size_t e)
+            {
+                size_t n = 0;
+                shade_visbuf( b, e, n);
+                fetches += n;
+            });
+            stats.texel_fetches += fetches;
+        }
+
+        if (depth_prepass and (mode == TEXTURE))
+            stats.texel_fetches_saved = stats.depth_writes - stats.texel_fetches;
+
+        if ( mode == ZBUF)
+            display_zbuf();
+    });
+
+
+    // Edges: every one of the mesh once, straight into the color buffer
+    // (HIDDEN_LINE tests them against the depths of its faces)
+    auto lines = frame.add( [&]
+    {
+        if ((mode != WIREFRAME) and (mode != HIDDEN_LINE))
+            return;
+
+        const auto& edges = model.face_edges( lod);
+        std::atomic<size_t> written{0};
+        workers->parallel_for( 0, edges.size(), EDGE_GRAIN,
+                               [&]( size_t b, size_t e)
+        {
+            written += draw_edges( b, e);
+        });
+        stats.pixel_writes = written;
+    });
+    frame.precede( lines, resolve);
+
+
+    if (composited)
+    {
+        // Depth reset: the first part draws into the window buffers
+        // and there are no tiles to clear them
+        auto clear = frame.add( [&]
+        {
+            stats.bytes_cleared += zbuf_clear( zbuf_stale);
+            for (screen_tile& t : tiles)
+                t.epoch = frame_number;
+        });
+
+        // Composite: rows of the partial images, earlier parts first
+        auto merge = frame.add( [&]
+        {
+            auto t2 = std::chrono::steady_clock::now();
+            workers->parallel_for( drawn.y0, drawn.y1, TILE_SIZE / 4,
+                                   [&]( size_t b, size_t e)
+            {
+                composite( b * STRIDE, e * STRIDE);
+            });
+            stats.composite_ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - t2).count();
+        });
+        frame.precede( merge, lines);
+
+        // Raster: every part has buffers of its own
+        for (size_t k = 0; k < parts.size(); k++)
+        {
+            auto raster = frame.add( [this, k] { render_part( k); });
+            frame.precede( order, raster);
+            frame.precede( raster, merge);
+            if (k == 0)
+                frame.precede( clear, raster);
+        }
+    }
+
+    // (no faces to draw, no depths to clear)
+    else if (mode == WIREFRAME)
+        frame.precede( order, lines);
+
+    else
+    {
+        // Binning: the faces overlapping every tile, in submission order
+        auto bin = frame.add( [&]
+        {
+            workers->parallel_for( 0, bin_chunks, 1, [&]( size_t b, size_t e)
+            {
+                for (size_t c = b; c < e; c++)
+                    bin_faces( c);
+            });
+        });
+        frame.precede( order, bin);
+
+        // Warp: where the pixels of the last frame are now
+        // (needs nothing of this frame but the camera)
+        auto warp = frame.add( [&]
+        {
+            if (reproject_frame)
+                workers->parallel_for( 0, tiles.size(), 4, [&]( size_t b, size_t e)
+                {
+                    for (size_t s = b; s < e; s++)
+                        warp_source( s);
+                });
+        });
+
+        // Raster: tiles share no pixels
+        for (size_t k = 0; k < tiles.size(); k++)
+        {
+            auto raster = frame.add( [this, k] { render_tile( k); });
+            frame.precede( bin, raster);
+            frame.precede( warp, raster);
+            frame.precede( raster, lines);
+        }
+    }
+
+
+    // (whatever happens, nothing is drawn outside the view,
+    //  nor left outside of what was not cleared yet)
+    zbuf_dirty = { 0, 0, VIEW_WIDTH, VIEW_HEIGHT};
+    if (cbuf_dirty)
+        *cbuf_dirty = zbuf_dirty;
+    zbuf_dirty.unite( zbuf_stale);
+
+    frame.run( *workers);
+
+    // (WIREFRAME leaves the depths as they were)
+    zbuf_dirty = (mode == WIREFRAME) ? zbuf_stale : drawn;
+    if (cbuf_dirty)
+        *cbuf_dirty = drawn;
+
+    stats.clusters_culled = culled;
+    stats.raster_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - t1).count();
+
+    scheduler::counters c = work.get();
+    stats.tasks     = c.tasks;
+    stats.steals    = c.steals;
+    stats.idle_ms   = c.idle_ms;
+
+    if (!reproject_frame)
+        stats.tiles = 0;
+
+    // (jittered samples are averaged later, they are no history)
+    if (reproject and !checking)
+    {
+        hist_valid = false;
+        if (!cancelled() and (jitter_x == 0) and (jitter_y == 0) and
+            ((mode == RAST) or (mode == TEXTURE) or (mode == VISBUF)))
+            save_history();
+    }
+
+    return;
+}
+
+
+
+// Binning chunk <c> of draw_order by the screen bounding box of the faces
+// (supports parallelization)
+void RTR::Renderer::bin_faces( size_t c)
+{
+    size_t ntiles   = tiles.size();
+    size_t ncols    = (BUF_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+    size_t len      = (draw_order.size() + bin_chunks - 1) / bin_chunks;
+    size_t end      = std::min( draw_order.size(), (c + 1) * len);
+
+    for (size_t k = 0; k < ntiles; k++)
+        bins[c * ntiles + k].clear();
+
+    for (size_t j = c * len; j < end; j++)
+    {
+        uint32_t i = draw_order[j];
+        if (!std::get<2>( projected[i]))
+            continue;
+
+        const triangle3i& tr = std::get<0>( projected[i]);
+        int xmin = std::min( { tr[0].x, tr[1].x, tr[2].x});
+        int xmax = std::max( { tr[0].x, tr[1].x, tr[2].x});
+        int ymin = std::min( { tr[0].y, tr[1].y, tr[2].y});
+        int ymax = std::max( { tr[0].y, tr[1].y, tr[2].y});
+
+        if ((xmax < 0) or (ymax < 0) or
+            (xmin >= VIEW_WIDTH) or (ymin >= VIEW_HEIGHT))
+            continue;
+
+        size_t cx0 = std::max( xmin, 0) / TILE_SIZE;
+        size_t cy0 = std::max( ymin, 0) / TILE_SIZE;
+        size_t cx1 = std::min( xmax, VIEW_WIDTH  - 1) / TILE_SIZE;
+        size_t cy1 = std::min( ymax, VIEW_HEIGHT - 1) / TILE_SIZE;
+
+        for (size_t ty = cy0; ty <= cy1; ty++)
+            for (size_t tx = cx0; tx <= cx1; tx++)
+                bins[c * ntiles + ty * ncols + tx].push_back( i);
+    }
+
+    return;
+}
+
+
+
+// Draws the faces binned to the tile <k>
+// (supports parallelization)
+void RTR::Renderer::render_tile( size_t k)
+{
+    screen_tile& t = tiles[k];
+    t.stats     = frame_stats();
+    touch_tile( t);
+
+    size_t ntiles = tiles.size();
+
+    if (reproject_frame and !warp_tile( k))
+        return;
+
+    if (mode == VISBUF)
+    {
+        // Visibility: only depth and the id of the nearest face
+        for (int y = t.y0; y < t.y1; y++)
+            std::fill( vbuf + t.x0 + y * STRIDE,
+                       vbuf + t.x1 + y * STRIDE, 0);
+
+        for (size_t c = 0; (c < bin_chunks) and !cancelled(); c++)
+            for (uint32_t i : bins[c * ntiles + k])
+            {
+                const triangle3i& tr = std::get<0>( projected[i]);
+                only_fill_zbuf( t, tr[0], tr[1], tr[2], i + 1);
+            }
+
+        return;
+    }
+
+    if ((mode == TEXTURE) and depth_prepass)
+    {
+        // Pass 1: depth only, pass 2: shade the pixels that kept their depth
+        for (size_t c = 0; c < bin_chunks; c++)
+            for (uint32_t i : bins[c * ntiles + k])
+            {
+                const triangle3i& tr = std::get<0>( projected[i]);
+                only_fill_zbuf( t, tr[0], tr[1], tr[2]);
+            }
+
+        for (int y = t.y0; y < t.y1; y++)
+            std::fill( zbuf_shaded.begin() + t.x0 + y * STRIDE,
+                       zbuf_shaded.begin() + t.x1 + y * STRIDE, 0);
+    }
+
+    // (a cancelled frame is never shown)
+    for (size_t c = 0; (c < bin_chunks) and !cancelled(); c++)
+        for (uint32_t i : bins[c * ntiles + k])
+            raster_face( t, i);
+
+    return;
+}
+
+
+
+// Draws the edges [begin, end) of the mesh, returns the pixels written
+// (supports parallelization)
+size_t RTR::Renderer::draw_edges( size_t begin, size_t end)
+{
+    const auto& edges = model.face_edges( lod);
+    const auto& twins = model.face_edge_twins( lod);
+    uint32_t    white = pack_color( 255u, 255u, 255u, 255u);
+
+    // (HIDDEN_LINE: back faces are dropped, an edge is drawn if
+    //  one of its faces is turned to us and then depth-tested)
+    const zbuf_depth_t* depths = (mode == HIDDEN_LINE) ? zbuf : nullptr;
+
+    size_t written = 0;
+    for (size_t j = begin; (j < end) and !cancelled(); j++)
+    {
+        // (otherwise a face is dropped only when it is out of the view,
+        //  so are its edges then, whatever face they are shared with)
+        uint32_t e = edges[j];
+        if (!std::get<2>( projected[e / 3]))
+        {
+            e = twins[j];
+            if (!std::get<2>( projected[e / 3]))
+                continue;
+        }
+
+        const triangle3i& tr = std::get<0>( projected[e / 3]);
+        written += draw_edge( tr[e % 3], tr[(e + 1) % 3], white, depths);
+    }
+
+    return written;
+}
+
+
+
+// Draws the range <p> of draw_order into the buffers of the part
+// (supports parallelization)
+void RTR::Renderer::render_part( size_t p)
+{
+    screen_tile& t = parts[p];
+    t.stats     = frame_stats();
+
+    size_t npixels = STRIDE * VIEW_HEIGHT;
+    size_t begin   = STRIDE * drawn.y0;      // the rows drawn
+    size_t end     = STRIDE * drawn.y1;      // (and merged)
+    if (p > 0)
+    {
+        // (only the pixels that pass the depth merge are read,
+        //  so colors and ids need no clearing)
+        part_zbuf[p].resize( npixels);
+        t.zbuf = part_zbuf[p].data();
+        std::fill( t.zbuf + begin, t.zbuf + end,
+                   std::numeric_limits<zbuf_depth_t>::min());
+        t.stats.bytes_cleared = (end - begin) * sizeof( zbuf_depth_t);
+
+        if (mode == VISBUF)
+        {
+            part_vbuf[p].resize( npixels);
+            t.vbuf = part_vbuf[p].data();
+        }
+        else
+        {
+            part_cbuf[p].resize( npixels);
+            t.cbuf = part_cbuf[p].data();
+        }
+    }
+
+    else if (mode == VISBUF)
+        std::fill( vbuf + begin, vbuf + end, 0);
+
+
+    size_t len  = (draw_order.size() + parts.size() - 1) / parts.size();
+    size_t last = std::min( draw_order.size(), (p + 1) * len);
+
+    for (size_t j = p * len; (j < last) and !cancelled(); j++)
+    {
+        uint32_t i = draw_order[j];
+        if (!std::get<2>( projected[i]))
+            continue;
+
+        if (mode == VISBUF)
+        {
+            const triangle3i& tr = std::get<0>( projected[i]);
+            only_fill_zbuf( t, tr[0], tr[1], tr[2], i + 1);
+        }
+        else
+            raster_face( t, i);
+    }
+
+    return;
+}
+
+
+
+#ifdef __SSE2__
+static inline __m128i select128( __m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128( _mm_and_si128( mask, a), _mm_andnot_si128( mask, b));
+}
+#endif
+
+
+
+// Sort-last depth merge of the pixels [begin, end) into the window buffers
+// (supports parallelization):
+// a part wins a pixel only if it is strictly closer, so with the parts
+// taken in order the result is the one of a single strict-test pass
+void RTR::Renderer::composite( size_t begin, size_t end)
+{
+    bool colors = (mode != VISBUF) and (mode != ZBUF);
+    bool ids    = (mode == VISBUF);
+
+    for (size_t p = 1; p < parts.size(); p++)
+    {
+        const screen_tile& src = parts[p];
+        size_t i = begin;
+
+    #ifdef __SSE2__
+        // 16 depths at a time, the mask widened to 32 bit for the pixels
+        if constexpr (sizeof( zbuf_depth_t) == 1)
+            for (; i + 16 <= end; i += 16)
+            {
+                __m128i zs = _mm_loadu_si128(
+                                reinterpret_cast<const __m128i*>( src.zbuf + i));
+                __m128i zd = _mm_loadu_si128(
+                                reinterpret_cast<const __m128i*>( zbuf + i));
+                __m128i m  = _mm_cmpgt_epi8( zs, zd);
+                if (_mm_movemask_epi8( m) == 0)
+                    continue;
+
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( zbuf + i),
+                                  select128( m, zs, zd));
+
+                __m128i lo = _mm_unpacklo_epi8( m, m);
+                __m128i hi = _mm_unpackhi_epi8( m, m);
+                __m128i m32[4] = { _mm_unpacklo_epi16( lo, lo),
+                                   _mm_unpackhi_epi16( lo, lo),
+                                   _mm_unpacklo_epi16( hi, hi),
+                                   _mm_unpackhi_epi16( hi, hi) };
+
+                uint32_t* dst = colors ? cbuf     : vbuf;
+                uint32_t* val = colors ? src.cbuf : src.vbuf;
+                if (colors or ids)
+                    for (size_t k = 0; k < 4; k++)
+                    {
+                        __m128i* d = reinterpret_cast<__m128i*>( dst + i + 4 * k);
+                        __m128i  v = _mm_loadu_si128(
+                                reinterpret_cast<const __m128i*>( val + i + 4 * k));
+                        _mm_storeu_si128( d, select128( m32[k], v,
+                                                        _mm_loadu_si128( d)));
+                    }
+            }
+    #endif
+
+        for (; i < end; i++)
+            if (src.zbuf[i] > zbuf[i])
+            {
+                zbuf[i] = src.zbuf[i];
+                if (colors)
+                    cbuf[i] = src.cbuf[i];
+                if (ids)
+                    vbuf[i] = src.vbuf[i];
+            }
+    }
+
+    return;
+}
+
+
+
+// Reprojection is worth it for small moves of the camera
+// over the frame saved last, in a mode that keeps its colors
+bool RTR::Renderer::reprojectable() const
+{
+    if (!reproject or checking or !hist_valid or (hist_view.mode != mode) or
+        (hist_lod != lod) or (hist_scale != view_scale) or
+        (jitter_x != 0) or (jitter_y != 0))
+        return false;
+
+    quaterniond turn = orientation * hist_view.orientation.get_reverse();
+    double      angle = 2 * std::acos( std::min( 1., std::abs( turn.w)));
+
+    vec3d shift( W_SHIFT - hist_view.W_SHIFT,
+                 H_SHIFT - hist_view.H_SHIFT,
+                 D_SHIFT - hist_view.D_SHIFT);
+
+    return (angle <= REPROJ_MAX_ANGLE) and (shift.norm() <= REPROJ_MAX_SHIFT);
+}
+
+
+
+// The frame just drawn becomes the history: its depths and colors
+// (or face ids) and the camera they were seen from
+void RTR::Renderer::save_history()
+{
+    size_t npixels = STRIDE * VIEW_HEIGHT;
+    hist_zbuf.resize( STRIDE * BUF_HEIGHT);
+    hist_cbuf.resize( STRIDE * BUF_HEIGHT);
+
+    const uint32_t* src = (mode == VISBUF) ? vbuf : cbuf;
+    workers->parallel_for( 0, npixels, TILE_SIZE * STRIDE,
+                           [&]( size_t b, size_t e)
+    {
+        std::copy( zbuf + b, zbuf + e, hist_zbuf.begin() + b);
+        std::copy( src + b,  src + e,  hist_cbuf.begin() + b);
+    });
+
+    hist_view   = current_view();
+    hist_scale  = view_scale;
+    hist_lod    = lod;
+    hist_valid  = true;
+}
+
+
+
+// Warp, the history tile <s>: every covered pixel goes back to model
+// space through its depth (project_vertice() inverted) and forward
+// through the new camera; the box of where they land is kept
+// (supports parallelization)
+void RTR::Renderer::warp_source( size_t s)
+{
+    const screen_tile& src = tiles[s];
+    std::array<int, 4>& box = warp_boxes[s];
+    box = { VIEW_WIDTH, VIEW_HEIGHT, -1, -1};
+
+    // the turn as a matrix, cheaper than a quaternion per pixel
+    quaterniond turn  = orientation * hist_view.orientation.get_reverse();
+    turn.normalize();
+    const double w = turn.w, qx = turn.x, qy = turn.y, qz = turn.z;
+    const double m[3][3] =
+    {
+        { 1 - 2 * (qy * qy + qz * qz), 2 * (qx * qy - w * qz),     2 * (qx * qz + w * qy)},
+        { 2 * (qx * qy + w * qz),     1 - 2 * (qx * qx + qz * qz), 2 * (qy * qz - w * qx)},
+        { 2 * (qx * qz - w * qy),     2 * (qy * qz + w * qx),     1 - 2 * (qx * qx + qy * qy)}
+    };
+
+    // p = new_shift - turn(old_shift - v) = c + turn(v)
+    vec3d old_shift( model.xshift() + hist_view.W_SHIFT,
+                     model.yshift() + hist_view.H_SHIFT,
+                     model.zshift() + hist_view.D_SHIFT);
+    vec3d new_shift( model.xshift() + W_SHIFT,
+                     model.yshift() + H_SHIFT,
+                     model.zshift() + D_SHIFT);
+    vec3d c = new_shift -
+              vec3d( m[0][0] * old_shift.x + m[0][1] * old_shift.y + m[0][2] * old_shift.z,
+                     m[1][0] * old_shift.x + m[1][1] * old_shift.y + m[1][2] * old_shift.z,
+                     m[2][0] * old_shift.x + m[2][1] * old_shift.y + m[2][2] * old_shift.z);
+
+    double scale = OBJ_SCALE * view_scale;
+
+    for (int y = src.y0; y < src.y1; y++)
+    {
+        // (pixels and depths were truncated, take the middle)
+        double vy = (y + 0.5 - VIEW_HEIGHT / 2.0) / scale;
+
+        for (int x = src.x0; x < src.x1; x++)
+        {
+            size_t          i  = x + y * STRIDE;
+            zbuf_depth_t    zq = hist_zbuf[i];
+            warp_pos[i] = WARP_NONE;
+            if (zq == std::numeric_limits<zbuf_depth_t>::min())
+                continue;
+
+            double vz  = (zq + ((zq < 0) ? -0.5 : 0.5)) / ZBUF_SCALE;
+            double div = std::max( PERSPECTIVE_FOCUS * vz + 1, 0.1);
+            double vx  = (x + 0.5 - VIEW_WIDTH / 2.0) / scale * div;
+            double wy  = vy * div;
+
+            double px = c.x + m[0][0] * vx + m[0][1] * wy + m[0][2] * vz;
+            double py = c.y + m[1][0] * vx + m[1][1] * wy + m[1][2] * vz;
+            double pz = c.z + m[2][0] * vx + m[2][1] * wy + m[2][2] * vz;
+
+            double f  = scale / std::max( PERSPECTIVE_FOCUS * pz + 1, 0.1);
+            double sx = px * f + VIEW_WIDTH  / 2.0;
+            double sy = py * f + VIEW_HEIGHT / 2.0;
+            if ((sx < 0) or (sy < 0) or (sx >= VIEW_WIDTH) or (sy >= VIEW_HEIGHT))
+                continue;
+
+            int nx = sx, ny = sy;
+            warp_pos[i] = uint32_t( nx) | (uint32_t( ny) << 16);
+            warp_z[i]   = std::clamp<double>( pz * ZBUF_SCALE,
+                                std::numeric_limits<zbuf_depth_t>::min() + 1,
+                                std::numeric_limits<zbuf_depth_t>::max());
+
+            box[0] = std::min( box[0], nx);
+            box[1] = std::min( box[1], ny);
+            box[2] = std::max( box[2], nx);
+            box[3] = std::max( box[3], ny);
+        }
+    }
+
+    return;
+}
+
+
+
+// Reprojection of the tile <k>: the warped pixels that land in it
+// with a depth test, then one pixel cracks filled from the nearer
+// neighbour. True if the tile has to be rasterized after all
+// (a wider hole inside the surface or its turn to be refreshed),
+// it is cleared again then
+// (supports parallelization)
+bool RTR::Renderer::warp_tile( size_t k)
+{
+    screen_tile& t = tiles[k];
+    if ((t.x0 >= t.x1) or (t.y0 >= t.y1))
+        return false;
+
+    if ((k + reproj_count) % REPROJ_REFRESH == 0)
+    {
+        t.stats.tiles_redrawn++;
+        return true;
+    }
+
+    const zbuf_depth_t empty = std::numeric_limits<zbuf_depth_t>::min();
+    bool      ids = (mode == VISBUF);
+    uint32_t* dst = ids ? t.vbuf : t.cbuf;
+    bool      landed = false;
+
+    if (ids)
+        for (int y = t.y0; y < t.y1; y++)
+            std::fill( vbuf + t.x0 + y * STRIDE,
+                       vbuf + t.x1 + y * STRIDE, 0);
+
+    // the history tiles whose pixels may land here, in order
+    for (size_t s = 0; s < tiles.size(); s++)
+    {
+        const std::array<int, 4>& box = warp_boxes[s];
+        if ((box[2] < t.x0) or (box[0] >= t.x1) or
+            (box[3] < t.y0) or (box[1] >= t.y1))
+            continue;
+
+        const screen_tile& src = tiles[s];
+        for (int y = src.y0; y < src.y1; y++)
+            for (int x = src.x0; x < src.x1; x++)
+            {
+                size_t   i   = x + y * STRIDE;
+                uint32_t pos = warp_pos[i];
+                if (pos == WARP_NONE)
+                    continue;
+
+                int nx = pos & 0xffff;
+                int ny = pos >> 16;
+                if ((nx < t.x0) or (nx >= t.x1) or (ny < t.y0) or (ny >= t.y1))
+                    continue;
+
+                // (the face may be culled or off the screen by now)
+                uint32_t value = hist_cbuf[i];
+                if (ids and !std::get<2>( projected[value - 1]))
+                    continue;
+
+                size_t j = nx + ny * STRIDE;
+                if (t.zbuf[j] < warp_z[i])
+                {
+                    t.zbuf[j] = warp_z[i];
+                    dst[j]    = value;
+                }
+                landed = true;
+            }
+    }
+
+
+    if (!landed)
+        return false;
+
+
+    // Distances to the nearest covered pixel of the tile
+    // in the four directions, from the warped pixels alone
+    int w = t.x1 - t.x0;
+    int h = t.y1 - t.y0;
+    std::array<uint8_t, TILE_SIZE * TILE_SIZE> left, right, up, down;
+
+    auto covered = [&]( int x, int y)
+    {
+        return t.zbuf[t.x0 + x + (t.y0 + y) * STRIDE] != empty;
+    };
+
+    auto step = []( uint8_t d) { return uint8_t( std::min( d + 1, 255)); };
+
+    for (int y = 0; y < h; y++)
+    {
+        uint8_t l = 255, r = 255;
+        for (int x = 0; x < w; x++)
+        {
+            l = covered( x, y) ? 0 : step( l);
+            left[x + y * TILE_SIZE] = l;
+
+            int xr = w - 1 - x;
+            r = covered( xr, y) ? 0 : step( r);
+            right[xr + y * TILE_SIZE] = r;
+        }
+    }
+
+    for (int x = 0; x < w; x++)
+    {
+        uint8_t u = 255, d = 255;
+        for (int y = 0; y < h; y++)
+        {
+            u = covered( x, y) ? 0 : step( u);
+            up[x + y * TILE_SIZE] = u;
+
+            int yd = h - 1 - y;
+            d = covered( x, yd) ? 0 : step( d);
+            down[x + yd * TILE_SIZE] = d;
+        }
+    }
+
+
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+        {
+            size_t a = x + y * TILE_SIZE;
+            if (left[a] == 0)
+                continue;
+
+            // a crack: a neighbour on both sides
+            size_t i = t.x0 + x + (t.y0 + y) * STRIDE;
+            int dx = (left[a] == 1) and (right[a] == 1);
+            int dy = !dx and (up[a] == 1) and (down[a] == 1);
+            if (dx or dy)
+            {
+                size_t n1 = i - dx - dy * STRIDE;
+                size_t n2 = i + dx + dy * STRIDE;
+                size_t n  = (t.zbuf[n1] >= t.zbuf[n2]) ? n1 : n2;
+                t.zbuf[i] = t.zbuf[n];
+                dst[i]    = dst[n];
+                continue;
+            }
+
+            // a hole: the surface around it is not far
+            if (((left[a] <= REPROJ_HOLE_RADIUS) and (right[a] <= REPROJ_HOLE_RADIUS)) or
+                ((up[a]   <= REPROJ_HOLE_RADIUS) and (down[a]  <= REPROJ_HOLE_RADIUS)))
+            {
+                // disoccluded: back to a cleared tile
+                for (int cy = t.y0; cy < t.y1; cy++)
+                {
+                    std::fill( t.zbuf + t.x0 + cy * STRIDE,
+                               t.zbuf + t.x1 + cy * STRIDE, empty);
+                    std::fill( t.cbuf + t.x0 + cy * STRIDE,
+                               t.cbuf + t.x1 + cy * STRIDE,
+                               pack_color( R_BGR, G_BGR, B_BGR, A_BGR));
+                }
+
+                t.stats.tiles_redrawn++;
+                return true;
+            }
+        }
+
+    return false;
+}
+
+
+
+// Validation (-t): the same view rendered in full into a buffer
+// of its own and compared with the reprojected frame
+std::optional<RTR::reprojection_error> RTR::Renderer::check_reprojection()
+{
+    if (!reproject_frame)
+        return std::nullopt;
+
+    render_target warped{ cbuf, zbuf, STRIDE, cbuf_dirty};
+    screen_rect   warped_drawn = drawn;
+
+    check_buf.resize( STRIDE * BUF_HEIGHT);
+    checking = true;
+    set_target( { check_buf.data(), zbuf});
+    clear_screen();
+    render_mode_threaded();
+    set_target( warped);
+    drawn    = warped_drawn;
+    checking = false;
+
+    std::atomic<size_t>   wrong{0};
+    std::atomic<uint64_t> diff{0};
+    workers->parallel_for( 0, VIEW_HEIGHT, TILE_SIZE / 4, [&]( size_t b, size_t e)
+    {
+        size_t   n = 0;
+        uint64_t d = 0;
+        for (size_t y = b; y < e; y++)
+            for (int x = 0; x < VIEW_WIDTH; x++)
+            {
+                uint32_t p = warped.color[x + y * STRIDE];
+                uint32_t q = check_buf[x + y * STRIDE];
+                if (((p ^ q) & 0xffffff) == 0)
+                    continue;
+
+                n++;
+                for (int ch = 0; ch < 3; ch++)
+                    d += std::abs( int( (p >> (8 * ch)) & 0xff) -
+                                   int( (q >> (8 * ch)) & 0xff));
+            }
+        wrong += n;
+        diff  += d;
+    });
+
+    double npixels = VIEW_WIDTH * VIEW_HEIGHT;
+    return reprojection_error{ 100. * wrong / npixels, diff / (3. * npixels)};
+}
+
+
+
+// Front-to-back ordering (supports parallelization):
+// LSD radix sort of the faces by the quantized depth of their projection,
+// the nearest come first so that hidden pixels fail the depth test early
+void RTR::Renderer::sort_front_to_back()
+{
+    size_t nfaces = projected.size();
+    size_t nparts = workers->size();
+    size_t chunk  = (nfaces + nparts - 1) / nparts;
+
+    sort_keys.resize( nfaces);
+    draw_order.resize( nfaces);
+    sort_tmp.resize( nfaces);
+
+    std::vector<std::array<size_t, 256>> hist( nparts);
+    for (int shift = 0; shift < 16; shift += 8)
+    {
+        // Histograms of the face ranges:
+        workers->parallel_for( 0, nparts, 1, [&]( size_t j, size_t)
+        {
+            hist[j].fill( 0);
+            size_t end = std::min( nfaces, (j + 1) * chunk);
+
+            // (the first pass makes the keys of its range too,
+            // sum of the three zbuf depths: greater is closer)
+            if (shift == 0)
+                for (size_t k = j * chunk; k < end; k++)
+                {
+                    const triangle3i& tr = std::get<0>( projected[k]);
+                    sort_keys[k]  = static_cast<uint16_t>(
+                                        SORT_KEY_BIAS - (tr[0].z + tr[1].z + tr[2].z));
+                    draw_order[k] = k;
+                }
+
+            for (size_t k = j * chunk; k < end; k++)
+                hist[j][(sort_keys[draw_order[k]] >> shift) & 0xFF]++;
+        });
+
+
+        // Every range gets its own offsets so the sort stays stable
+        // (a digit shared by all the keys needs no pass at all):
+        size_t offset = 0;
+        bool   same   = false;
+        for (size_t d = 0; d < 256; d++)
+        {
+            size_t count = 0;
+            for (size_t j = 0; j < nparts; j++)
+            {
+                size_t n    = hist[j][d];
+                hist[j][d]  = offset + count;
+                count      += n;
+            }
+
+            same   |= (count == nfaces);
+            offset += count;
+        }
+
+        if (same)
+            continue;
+
+
+        // Scatter:
+        workers->parallel_for( 0, nparts, 1, [&]( size_t j, size_t)
+        {
+            size_t end = std::min( nfaces, (j + 1) * chunk);
+            for (size_t k = j * chunk; k < end; k++)
+            {
+                uint32_t i = draw_order[k];
+                sort_tmp[hist[j][(sort_keys[i] >> shift) & 0xFF]++] = i;
+            }
+        });
+
+        draw_order.swap( sort_tmp);
+    }
+
+    return;
+}
+
+
+
+// RAND: a color per face and frame that does not depend on
+// which thread draws the face (unlike std::rand())
+static uint32_t face_hash( uint32_t face, uint32_t frame)
+{
+    uint32_t h = face * 0x9E3779B9u ^ frame * 0x85EBCA6Bu;
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return h;
+}
+
+
+
+void RTR::Renderer::raster_face( screen_tile& t, size_t i)
+{
+    uint32_t r = 0;
+    uint8_t red     = 0;
+    uint8_t green   = 0;
+    uint8_t blue    = 0;
+    uint8_t alpha   = 0;
+
+    const triangle3i&    tr          = std::get<0>( projected[i]);
+    double              intensity   = std::get<1>( projected[i]);
+
+    intensity *= intensity;
+    switch( mode)
+    {
+        case TEXTURE :
+            if (intensity >= 0)
+            {
+                vec2i tv[3];
+                for( size_t k = 0; k < 3; ++k)
+                    tv[k] = model.tv(i, k, lod);
+
+                draw_triangle( t, tr[0], tr[1], tr[2],
+                               tv[0], tv[1], tv[2],
+                               intensity);
+            }
+            break;
+
+
+
+        case ZBUF :
+        case HIDDEN_LINE :
+                // (colors come from the depths once they are all known,
+                //  or the lines are drawn over them)
+                only_fill_zbuf( t, tr[0], tr[1], tr[2]);
+                break;
+                
+                
+
+        case RAST :
+            if (intensity >= 0)
+            {
+                red = green = blue = alpha = intensity * 255u;
+                t.set_draw_color( red, green,
+                                  blue, alpha);
+                draw_triangle( t, tr[0],  tr[1],  tr[2]);
+            }
+            break;
+            
+            
+            
+        case RAND : 
+            {
+                r       = face_hash( i, frame_number);
+                red     = r % 256;
+                green   = (r >> 8)  % 256;
+                blue    = (r >> 16) % 256;
+                alpha   = (r >> 24) % 256;
+                t.set_draw_color( red, green,
+                                  blue, alpha);
+                draw_triangle( t, tr[0],  tr[1],  tr[2]);
+            }
+            break;
+            
+            
+            
+        // (the lines of WIREFRAME are the edges of the mesh, see draw_edges())
+        case N_RM_RST :
+            if (intensity >= 0)
+            {
+                red = green = blue = alpha = intensity * 255u;
+                t.set_draw_color( red, green,
+                                  blue, alpha);
+                draw_triangle( t, vec2i(tr[0].x, tr[0].y), 
+                            vec2i(tr[1].x, tr[1].y),
+                            vec2i(tr[2].x, tr[2].y));
+            }
+             
+             break;
+      default : break;
+    }
+
+    return;
+}
+
+
+// VISBUF shading pass (supports parallelization):
+// texture coordinates of the visible face are restored
+// from the barycentric coordinates of the pixel in its projection
+void RTR::Renderer::shade_visbuf( int ybegin, int yend, size_t& fetches)
+{
+    double tex_w = model.diffuse_width()  - 1;
+    double tex_h = model.diffuse_height() - 1;
+
+    for (int y = ybegin; (y < yend) and !cancelled(); ++y)
+        for (int x = 0; x < VIEW_WIDTH; ++x)
+        {
+            size_t      i   = x + y * STRIDE;
+            uint32_t    id  = vbuf[i];
+            if (id == 0)
+                continue;
+
+            size_t              face        = id - 1;
+            const triangle3i&   tr          = std::get<0>( projected[face]);
+            double              intensity   = std::get<1>( projected[face]);
+            intensity *= intensity;
+
+            vec3d   bc( 1, 0, 0);
+            double  d = (tr[1].x - tr[0].x) * (tr[2].y - tr[0].y) -
+                        (tr[2].x - tr[0].x) * (tr[1].y - tr[0].y);
+            if (d != 0)
+            {
+                bc.y = ((x - tr[0].x) * (tr[2].y - tr[0].y) -
+                        (tr[2].x - tr[0].x) * (y - tr[0].y)) / d;
+                bc.z = ((tr[1].x - tr[0].x) * (y - tr[0].y) -
+                        (x - tr[0].x) * (tr[1].y - tr[0].y)) / d;
+                bc.x = 1 - bc.y - bc.z;
+
+                // scanline coverage may stick out of the exact triangle
+                for (size_t k = 0; k < 3; ++k)
+                    bc[k] = std::clamp( bc[k], 0., 1.);
+                bc = bc * (1 / (bc.x + bc.y + bc.z));
+            }
+
+            vec2d t;
+            for (size_t k = 0; k < 3; ++k)
+                t = t + vec2d( model.tv( face, k, lod)) * bc[k];
+
+            t.x = std::clamp( t.x, 0., tex_w);
+            t.y = std::clamp( t.y, 0., tex_h);
+            color clr = filter_textures
+                            ? filtered_texel( t.x, t.y)
+                            : model.tv_clr( static_cast<int>( t.x),
+                                            static_cast<int>( t.y));
+            fetches++;
+
+            cbuf[i] = pack_color( clr.r * intensity, clr.g * intensity,
+                                  clr.b * intensity, clr.a * intensity);
+        }
+
+    return;
+}
+
+
+
+// Bilinear lookup between the four texels around (u, v)
+// (the coordinates of model.tv(), a texel is hit at its corner)
+RTR::color RTR::Renderer::filtered_texel( double u, double v)
+{
+    int w = model.diffuse_width();
+    int h = model.diffuse_height();
+
+    u = std::clamp( u - 0.5, 0., w - 1.);
+    v = std::clamp( v - 0.5, 0., h - 1.);
+
+    int     x0 = u, y0 = v;
+    int     x1 = std::min( x0 + 1, w - 1);
+    int     y1 = std::min( y0 + 1, h - 1);
+    double  fx = u - x0;
+    double  fy = v - y0;
+
+    color c00 = model.tv_clr( x0, y0), c10 = model.tv_clr( x1, y0);
+    color c01 = model.tv_clr( x0, y1), c11 = model.tv_clr( x1, y1);
+
+    auto mix = [&]( uint8_t color::* ch)
+    {
+        double top    = c00.*ch + (c10.*ch - c00.*ch) * fx;
+        double bottom = c01.*ch + (c11.*ch - c01.*ch) * fx;
+        return static_cast<uint8_t>( top + (bottom - top) * fy + 0.5);
+    };
+
+    return color{ mix( &color::r), mix( &color::g),
+                  mix( &color::b), mix( &color::a)};
+}
+
+
+
+  //  std::cout<<"z_"<<z<<std::endl;
+
+
+
+// Thread routine:
+// using macro because of the need of founding xmin, xmax, ...
+#define project_vertice(/* vec3d world[j] */)\
+{               \
+    /* Rotate: */                                                        \
+    orientation.rotate( world[j]);\
+                                                                        \
+    /* Shift: */                                                \
+    world[j].x = model.xshift() - world[j].x + W_SHIFT;         \
+    world[j].y = model.yshift() - world[j].y + H_SHIFT;         \
+    world[j].z = model.zshift() - world[j].z + D_SHIFT;         \
+                                                                    \
+    /* Perspective: */                                              \
+    double div = PERSPECTIVE_FOCUS * world[j].z + 1;                \
+    if (div < 0.1)                                                  \
+        div = 0.1;                                                  \
+                                                                    \
+    world[j].x /= div;                                              \
+    world[j].y /= div;                                              \
+                                                                    \
+    x = ( world[j].x) * OBJ_SCALE * view_scale                      \
+                                    + VIEW_WIDTH / 2.0 + jitter_x;  \
+                                                                    \
+    y = ( world[j].y) * OBJ_SCALE * view_scale                      \
+                                    + VIEW_HEIGHT / 2.0 + jitter_y; \
+                                                                    \
+    double tempz =  (  world[j].z)  * ZBUF_SCALE;                   \
+    if ( tempz >= std::numeric_limits<zbuf_depth_t>::max() )        \
+        z = std::numeric_limits<zbuf_depth_t>::max();               \
+                                                                    \
+    if ( tempz <= std::numeric_limits<zbuf_depth_t>::min() )        \
+        z = std::numeric_limits<zbuf_depth_t>::min();               \
+                                                                    \
+    else                                                            \
+        z = tempz;                                                  \
+                                                                    \
+}
+ 
+
+
+// The coarsest level of detail whose error stays below lod_threshold
+// pixels at the nearest point of the model
+size_t RTR::Renderer::select_lod() const
+{
+    if (lod_threshold <= 0)
+        return 0;
+
+    double radius = std::sqrt( model.xborder() * model.xborder() +
+                               model.yborder() * model.yborder() +
+                               model.zborder() * model.zborder());
+    double div    = PERSPECTIVE_FOCUS * (D_SHIFT + radius) + 1;
+    if (div < 0.1)
+        div = 0.1;
+
+    size_t res = 0;
+    for (size_t l = 1; l < model.nlods(); l++)
+        if (model.lod_error( l) * OBJ_SCALE * view_scale / div <= lod_threshold)
+            res = l;
+
+    return res;
+}
+
+
+
+// Projects the faces of the clusters [begin, end)
+// (supports parallelization)
+void RTR::Renderer::project_clusters( size_t begin, size_t end,
+                                    const vec3d& light,
+                                    size_t& culled, screen_rect& box)
+{
+    const auto& clusters = model.face_clusters( lod);
+    auto retval = projected.data();
+
+    box = screen_rect();
+    for (size_t k = begin; k < end; k++)
+    {
+        const mesh_cluster& c = clusters[k];
+
+        if (cluster_visible( c))
+            for (size_t f = c.first; f < c.first + c.count; f++)
+            {
+                uint32_t i = model.cluster_face( f, lod);
+                project_face( retval, i, i, light);
+                if (!std::get<2>( projected[i]))
+                    continue;
+
+                // (no primitive leaves the box of its vertices)
+                const triangle3i& tr = std::get<0>( projected[i]);
+                box.unite( { std::min( { tr[0].x, tr[1].x, tr[2].x}),
+                             std::min( { tr[0].y, tr[1].y, tr[2].y}),
+                             std::max( { tr[0].x, tr[1].x, tr[2].x}) + 1,
+                             std::max( { tr[0].y, tr[1].y, tr[2].y}) + 1});
+            }
+
+        else
+        {
+            culled++;
+            for (size_t f = c.first; f < c.first + c.count; f++)
+                std::get<2>( projected[ model.cluster_face( f, lod)]) = false;
+        }
+    }
+
+    return;
+}
+
+
+
+// Conservative test of the whole cluster before its vertices are touched:
+// the bounding sphere against the screen and, with back-face culling,
+// the normal cone against the camera
+bool RTR::Renderer::cluster_visible( const mesh_cluster& c) const
+{
+    // rotated model space, project_vertice() makes it p' = shift - p
+    vec3d center = c.center;
+    orientation.rotate( center);
+
+    vec3d shift( model.xshift() + W_SHIFT,
+                 model.yshift() + H_SHIFT,
+                 model.zshift() + D_SHIFT);
+    vec3d p = shift - center;
+
+    double d1   = PERSPECTIVE_FOCUS * (p.z - c.radius) + 1;
+    double d2   = PERSPECTIVE_FOCUS * (p.z + c.radius) + 1;
+    double dmin = std::min( d1, d2);
+    double dmax = std::max( d1, d2);
+
+    // (too close to the camera to tell)
+    if (dmin > 0.1)
+    {
+        double xmin = std::min( (p.x - c.radius) / dmin, (p.x - c.radius) / dmax);
+        double xmax = std::max( (p.x + c.radius) / dmin, (p.x + c.radius) / dmax);
+        double ymin = std::min( (p.y - c.radius) / dmin, (p.y - c.radius) / dmax);
+        double ymax = std::max( (p.y + c.radius) / dmin, (p.y + c.radius) / dmax);
+
+        // one pixel of slack for the truncation in project_vertice()
+        double scale = OBJ_SCALE * view_scale;
+        if ((xmax * scale + VIEW_WIDTH  / 2.0 < -1) or
+            (xmin * scale + VIEW_WIDTH  / 2.0 > VIEW_WIDTH + 1) or
+            (ymax * scale + VIEW_HEIGHT / 2.0 < -1) or
+            (ymin * scale + VIEW_HEIGHT / 2.0 > VIEW_HEIGHT + 1))
+            return false;
+    }
+
+    if (cull_backfaces and (c.cone_cutoff <= 1))
+    {
+        // the perspective singularity of project_vertice()
+        vec3d camera = shift - vec3d( 0, 0, -1 / PERSPECTIVE_FOCUS);
+        vec3d axis   = c.cone_axis;
+        orientation.rotate( axis);
+
+        vec3d view = center - camera;
+        if (view * axis >= c.cone_cutoff * view.norm() + c.radius)
+            return false;
+    }
+
+    return true;
+}
+
+
+
+// (supports parallelization)
+void RTR::Renderer::project_face( tuple_triangle3i_double_bool*& info,
+                                size_t infoIDX,
+                                size_t i,
+                                const vec3d& light)
+{
+
+    auto face =  model.face(i, lod);
+
+    triangle3i projection;
+
+    bool    isOnScreen  = true;
+    int     xmin        = VIEW_WIDTH;
+    int     xmax        = 0;
+    int     ymin        = VIEW_HEIGHT;
+    int     ymax        = 0;
+
+
+    vec3d world[3];
+
+    for(size_t j = 0; j < 3; ++j)
+    {
+        world[j] = model.vertice(face[j]);
+        int     x, y, z;
+
+        project_vertice();       // "fills" x, y, z;
+
+        if (xmin > x) xmin = x;
+        if (xmax < x) xmax = x;
+        if (ymin > y) ymin = y;
+        if (ymax < y) ymax = y;
+
+        projection[j] = vec3i( x, y, z);
+    }
+
+    vec3d n = (world[2] - world[0]) ^ (world[1] - world[0]);
+
+    // n.z is twice the signed area on the screen
+    if (cull_backfaces and (n.z <= 0))
+        isOnScreen = false;
+
+    n.normalize();
+    double intensity = n * light;
+
+    assert( intensity <= 1);
+
+
+    if ( (xmin > VIEW_WIDTH) or (xmax < 0))
+        isOnScreen = false;
+
+    if ( (ymin > VIEW_HEIGHT) or (ymax < 0))
+        isOnScreen = false;
+
+    info[ infoIDX] = std::make_tuple( projection, intensity, isOnScreen);
+
+    return;
+
+}
+
+#undef project_vertice
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+
+
+
+///////////////////////////////////////////////////////////////////////////
+// Render samples:
+//
+void RTR::Renderer::render_lines()
+{
+    screen_tile t = whole_screen();
+    t.set_draw_color( 255, 0, 0, 255);
+    draw_point( t, BUF_WIDTH / 2, BUF_HEIGHT / 2);
+
+    bool ok = true;
+    int fib = 1, prev_fib = 0;
+    int new_x = BUF_WIDTH / 2, new_y = BUF_HEIGHT / 2,
+        prev_x = BUF_WIDTH / 2, prev_y = BUF_HEIGHT / 2;
+    bool gold = (mode == GOLD);
+
+    while(ok)
+    {
+        draw_line( t, prev_x, prev_y, new_x, new_y);
+
+        if(gold)
+        {
+            fib += prev_fib;
+            prev_fib = fib;
+        }
+        else
+        {
+            prev_fib = fib++;
+        }
+        prev_x = new_x;
+        prev_y = new_y;
+        static int i = 0;
+        switch(i++)
+        {
+            case 0:
+                new_x = prev_x + fib;
+                new_y = prev_y - fib;
+                break;
+            case 1:
+                new_x = prev_x + fib;
+                new_y = prev_y + fib;
+                break;
+            case 2:
+                new_x = prev_x - fib;
+                new_y = prev_y + fib;
+                break;
+            case 3:
+                new_x = prev_x - fib;
+                new_y = prev_y - fib;
+                break;
+        }
+
+        i %= 4;
+
+        if (( (new_x < 0) || (new_x > BUF_WIDTH) )
+                        || ( (new_y < 0) || (new_y > BUF_HEIGHT)))
+        {
+            if(new_x < 0)
+            {
+                new_y = new_y + new_x * (new_y - prev_y)
+                                        / (double) (new_x - prev_x);
+                new_x = 0;
+            }
+            if(new_x > BUF_WIDTH)
+            {
+                new_y = new_y - (new_x - BUF_WIDTH) *
+                                (new_y - prev_y) /
+                                (double) (new_x - prev_x);
+                new_x = BUF_WIDTH;
+            }
+
+            if(new_y < 0)
+            {
+                new_x = new_x + new_y *
+                                (new_x - prev_x) /
+                                (double) (new_y - prev_y);
+                new_y = 0;
+            }
+            if(new_y > BUF_HEIGHT)
+            {
+                new_x = new_x - (new_y - BUF_HEIGHT) *
+                                (new_x - prev_x) /
+                                (double) (new_y - prev_y);
+                new_y = BUF_HEIGHT;
+            }
+
+            draw_line( t, prev_x, prev_y, new_x, new_y);
+
+            ok = false;
+        }
+    }
+
+    return;
+}
+
+
+
+void RTR::Renderer::render_triangles()
+{
+    screen_tile t = whole_screen();
+
+    vec3i v1(100, 400, -10);
+    vec3i v2(700, 250, -1);
+    vec3i v3(700, 550, -1);
+    t.set_draw_color( 255, 0, 0, 255);
+    draw_triangle( t, v1, v2, v3);
+
+    v1 = vec3i(300, 100, -5);
+    v2 = vec3i(300, 700, -5);
+    v3 = vec3i(525, 400, -1);
+    t.set_draw_color( 0, 255, 0, 255);
+    draw_triangle( t, v1, v2, v3);
+
+    v1 = vec3i(600, 50, -5);
+    v2 = vec3i(600, 750, -5);
+    v3 = vec3i(475, 400, -1);
+    t.set_draw_color( 0, 0, 255, 255);
+    draw_triangle( t, v1, v2, v3);
+
+    return;
+}
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+
+
+///////////////////////////////////////////////////////////////////////////
+// MISC
+//
+// a row of empty depths
+// (memset() for byte depths, it is vectorized already)
+static inline void clear_depths( RTR::zbuf_depth_t* row, size_t n)
+{
+    using depth = RTR::zbuf_depth_t;
+    if constexpr (sizeof( depth) == 1)
+        std::memset( row, std::numeric_limits<depth>::min(), n);
+    else
+        std::fill( row, row + n, std::numeric_limits<depth>::min());
+}
+
+
+
+// Clears the depths of <r>, the rows split between the workers
+// (the tiles do without, see touch_tile()); returns the bytes cleared
+size_t RTR::Renderer::zbuf_clear( const screen_rect& r)
+{
+    assert( zbuf != nullptr);
+
+    workers->parallel_for( r.y0, r.y1, TILE_SIZE, [&]( size_t b, size_t e)
+    {
+        for (size_t y = b; y < e; y++)
+            clear_depths( zbuf + r.x0 + y * STRIDE, r.x1 - r.x0);
+    });
+
+    return r.area() * sizeof(zbuf_depth_t);
+}
+
+
+
+// Depth reset on first touch: a tile not cleared for this frame yet
+// clears its part of the last frame's depths
+// (the whole cell, its part of the view may have been larger then)
+void RTR::Renderer::touch_tile( screen_tile& t)
+{
+    if (t.epoch == frame_number)
+        return;
+
+    t.epoch = frame_number;
+
+    screen_rect cell{ t.x0, t.y0, t.x0 + TILE_SIZE, t.y0 + TILE_SIZE};
+    screen_rect r = cell.intersect( zbuf_stale);
+    if (r.empty())
+        return;
+
+    for (int y = r.y0; y < r.y1; y++)
+        clear_depths( t.zbuf + r.x0 + y * STRIDE, r.x1 - r.x0);
+
+    t.stats.bytes_cleared += r.area() * sizeof(zbuf_depth_t);
+}
+
+
+// Depth range of a row: <lo>/<hi> take in its non-empty depths
+static void depth_range( const RTR::zbuf_depth_t* z, size_t n, int& lo, int& hi)
+{
+    using depth = RTR::zbuf_depth_t;
+    const depth empty = std::numeric_limits<depth>::min();
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // SSE2 compares only unsigned bytes: the depths are biased,
+    // the empty one becomes 0 and is lifted out of the minimum
+    if constexpr (sizeof( depth) == 1)
+    {
+        const __m128i bias = _mm_set1_epi8( char( 0x80));
+        const __m128i zero = _mm_setzero_si128();
+        __m128i vmin = _mm_set1_epi8( char( 0xff));
+        __m128i vmax = zero;
+
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i u = _mm_xor_si128( bias, _mm_loadu_si128(
+                                    reinterpret_cast<const __m128i*>( z + i)));
+            vmin = _mm_min_epu8( vmin, _mm_or_si128( u, _mm_cmpeq_epi8( u, zero)));
+            vmax = _mm_max_epu8( vmax, u);
+        }
+
+        alignas(16) uint8_t mins[16], maxs[16];
+        _mm_store_si128( reinterpret_cast<__m128i*>( mins), vmin);
+        _mm_store_si128( reinterpret_cast<__m128i*>( maxs), vmax);
+
+        int umin = *std::min_element( mins, mins + 16);
+        int umax = *std::max_element( maxs, maxs + 16);
+        if (umax > 0)
+        {
+            lo = std::min( lo, umin - 0x80);
+            hi = std::max( hi, umax - 0x80);
+        }
+    }
+#endif
+
+    for (; i < n; i++)
+        if (z[i] != empty)
+        {
+            lo = std::min<int>( lo, z[i]);
+            hi = std::max<int>( hi, z[i]);
+        }
+}
+
+
+
+// Grays of a row: the depths [lo, hi] spread over [0, 255], empty black
+// (lo < hi; the division is exact in float, both paths agree)
+static void depth_grays( const RTR::zbuf_depth_t* z, uint32_t* dst, size_t n,
+                         int lo, int hi)
+{
+    using depth = RTR::zbuf_depth_t;
+    const depth empty = std::numeric_limits<depth>::min();
+    const int   range = hi - lo;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // 16 depths at a time, widened to 32 bit lanes like the pixels
+    if constexpr (sizeof( depth) == 1)
+    {
+        const __m128i zero   = _mm_setzero_si128();
+        const __m128i vlo    = _mm_set1_epi32( lo);
+        const __m128  k255   = _mm_set1_ps( 255.f);
+        const __m128  vrange = _mm_set1_ps( float( range));
+
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( z + i));
+            __m128i e = _mm_cmpeq_epi8( b, _mm_set1_epi8( char( empty)));
+
+            __m128i s  = _mm_cmpgt_epi8( zero, b);
+            __m128i lo16 = _mm_unpacklo_epi8( b, s);
+            __m128i hi16 = _mm_unpackhi_epi8( b, s);
+            __m128i d32[4] = { _mm_unpacklo_epi16( lo16, _mm_srai_epi16( lo16, 15)),
+                               _mm_unpackhi_epi16( lo16, _mm_srai_epi16( lo16, 15)),
+                               _mm_unpacklo_epi16( hi16, _mm_srai_epi16( hi16, 15)),
+                               _mm_unpackhi_epi16( hi16, _mm_srai_epi16( hi16, 15)) };
+
+            __m128i elo = _mm_unpacklo_epi8( e, e);
+            __m128i ehi = _mm_unpackhi_epi8( e, e);
+            __m128i e32[4] = { _mm_unpacklo_epi16( elo, elo),
+                               _mm_unpackhi_epi16( elo, elo),
+                               _mm_unpacklo_epi16( ehi, ehi),
+                               _mm_unpackhi_epi16( ehi, ehi) };
+
+            for (size_t k = 0; k < 4; k++)
+            {
+                __m128 f = _mm_cvtepi32_ps( _mm_sub_epi32( d32[k], vlo));
+                __m128i g = _mm_cvttps_epi32( _mm_div_ps( _mm_mul_ps( f, k255), vrange));
+                g = _mm_or_si128( _mm_or_si128( g, _mm_slli_epi32( g, 8)),
+                                  _mm_or_si128( _mm_slli_epi32( g, 16),
+                                                _mm_slli_epi32( g, 24)));
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( dst + i + 4 * k),
+                                  _mm_andnot_si128( e32[k], g));
+            }
+        }
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        uint8_t g = (z[i] == empty) ? 0 : (z[i] - lo) * 255 / range;
+        dst[i] = RTR::pack_color( g, g, g, g);
+    }
+}
+
+
+
+// ZBUF: the depths of the frame as grays, the nearest white
+// (a parallel min/max reduction, then a parallel pass into cbuf;
+//  outside of what was drawn the depths are empty, black anyway)
+void RTR::Renderer::display_zbuf()
+{
+    const screen_rect& r = drawn;
+    const size_t grain   = TILE_SIZE / 4;
+    size_t nchunks = (r.y1 - r.y0 + grain - 1) / grain;
+
+    std::vector<std::pair<int, int>> ranges( nchunks,
+                        { std::numeric_limits<int>::max(),
+                          std::numeric_limits<int>::min()});
+
+    workers->parallel_for( r.y0, r.y1, grain, [&]( size_t b, size_t e)
+    {
+        auto& [lo, hi] = ranges[(b - r.y0) / grain];
+        for (size_t y = b; y < e; y++)
+            depth_range( zbuf + r.x0 + y * STRIDE, r.x1 - r.x0, lo, hi);
+    });
+
+    int lo = std::numeric_limits<int>::max();
+    int hi = std::numeric_limits<int>::min();
+    for (auto [l, h] : ranges)
+    {
+        lo = std::min( lo, l);
+        hi = std::max( hi, h);
+    }
+
+    if (lo > hi)
+        return;
+
+    // (a single depth is white)
+    if (lo == hi)
+        lo = hi - 1;
+
+    workers->parallel_for( r.y0, r.y1, grain, [&]( size_t b, size_t e)
+    {
+        for (size_t y = b; y < e; y++)
+            depth_grays( zbuf + r.x0 + y * STRIDE, cbuf + r.x0 + y * STRIDE,
+                         r.x1 - r.x0, lo, hi);
+    });
+
+    return;
+}
+
+
+
+// clears the color buffer, only its dirty part if that is known
+// (the rows split between the workers)
+void RTR::Renderer::clear_screen()
+{
+    uint32_t    bgr = pack_color( R_BGR, G_BGR, B_BGR, A_BGR);
+    screen_rect r   = cbuf_dirty ? *cbuf_dirty
+                                 : screen_rect{ 0, 0, BUF_WIDTH, VIEW_HEIGHT};
+
+    workers->parallel_for( r.y0, r.y1, TILE_SIZE, [&]( size_t b, size_t e)
+    {
+        for (size_t y = b; y < e; y++)
+            std::fill( cbuf + r.x0 + y * STRIDE, cbuf + r.x1 + y * STRIDE, bgr);
+    });
+
+    bytes_cleared += r.area() * sizeof(uint32_t);
+    if (cbuf_dirty)
+        *cbuf_dirty = screen_rect();
+    return;
+}
+
+
+//
+//
+///////////////////////////////////////////////////////////////////////////
@@ -1,27 +1,81 @@
 #include "rtrenderer.hpp"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 
 // Basic methods:
 ///////////////////////////////////////////////////////////////////////////
 //  Constructor/Destructor:
 //
     RTR::Window::Window(int argc, char** argv, char* filename)
-    : model( filename)
+    : model( asset_registry::shared().model( filename))
     {
         argv_parse2( argc, argv);
-        
-        int ret = SDL_CreateWindowAndRenderer(  WIN_WIDTH,  WIN_HEIGHT, 0,
-                                                &window, &renderer);
-        if (ret < 0) throw sdl_error();
-        
-        clear_screen();
-        
-        SDL_RenderPresent(renderer);
+        start_workers();
+
+        // (batch mode is headless: nothing is shown, no video driver needed)
+        if (batch_views.empty())
+        {
+            int ret = SDL_CreateWindowAndRenderer( WIN_WIDTH, WIN_HEIGHT, 0,
+                                                   &window, &renderer);
+            if (ret < 0) throw sdl_error();
 
-        pool = new std::thread[ N_MACHINES];
+            // (smaller frames are stretched, blocky without filtering)
+            if (target_ms > 0)
+                SDL_SetHint( SDL_HINT_RENDER_SCALE_QUALITY, "linear");
 
-        zbuf = new zbuf_depth_t[WIN_WIDTH * WIN_HEIGHT];
-            zbuf_clear();
+            frame = SDL_CreateTexture( renderer, SDL_PIXELFORMAT_RGB888,
+                                       SDL_TEXTUREACCESS_STREAMING,
+                                       WIN_WIDTH, WIN_HEIGHT);
+            if (frame == nullptr) throw sdl_error();
+
+            screen_buf = new uint32_t[WIN_WIDTH * WIN_HEIGHT];
+            std::fill( screen_buf, screen_buf + WIN_WIDTH * WIN_HEIGHT,
+                       pack_color( R_BGR, G_BGR, B_BGR, A_BGR));
+
+            present( screen_buf);
+        }
+
+        core = std::make_unique<Renderer>( *model, WIN_WIDTH, WIN_HEIGHT, *workers);
+        core->set_lod_threshold( lod_threshold);
+        core->set_cancel_flag( &cancel_frame);
+
+        if (!ring_name.empty())
+            ring = std::make_unique<frame_ring>( ring_name, WIN_WIDTH, WIN_HEIGHT,
+                                                 FRAME_RING_SLOTS, ring_depths);
+
+        return;
+    }
+
+
+
+
+    // Rendering threads: -j of them (every core by default),
+    // with -a or -r each worker is pinned to a core of its own
+    // and -r keeps one core for the thread that presents frames
+    void RTR::Window::start_workers()
+    {
+        size_t ncores = std::max( 1u, std::thread::hardware_concurrency());
+        if (n_threads == 0)
+            n_threads = ncores;
+
+        std::vector<size_t> cores;
+        if (pin_threads or (present_core >= 0))
+            for (size_t c = 0; c < ncores; c++)
+                if (static_cast<int>( c) != present_core)
+                    cores.push_back( c);
+
+        if (present_core >= 0)
+        {
+            if ((static_cast<size_t>( present_core) >= ncores) or cores.empty())
+                throw bad_input();
+
+            scheduler::pin_to_core( present_core);
+        }
+
+        workers = std::make_unique<scheduler>( n_threads, cores);
 
         return;
     }
@@ -31,12 +85,17 @@
 
     RTR::Window::~Window()
     {
-        delete [] zbuf;
-        delete [] pool;
+        stop_pipeline();
+
+        delete [] screen_buf;
 
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
-        SDL_Quit();
+        if (window != nullptr)
+        {
+            SDL_DestroyTexture(frame);
+            SDL_DestroyRenderer(renderer);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+        }
 
         return;
     }
@@ -111,31 +170,148 @@
                         show_usage();
 
 
-                    if(      strcmp( argv[i + 1], "wire") == 0)
-                        mode = WIREFRAME;
+                    mode = mode_by_name( argv[i + 1]);
+                    if( mode == null)
+                        show_usage();
+
+                    flag2 = true;
+                    i += 2;
+                    break;
+
+                case 'p' :
+                    depth_prepass = true;
+                    i += 1;
+                    break;
 
-                    else if( strcmp( argv[i + 1], "dont_remove") == 0)
-                        mode = N_RM_RST;
+                case 'c' :
+                    backface_culling = true;
+                    i += 1;
+                    break;
 
-                    else if( strcmp( argv[i + 1], "rand") == 0)
-                        mode = RAND;
+                case 'l' :
+                    if( (i + 1 >= argc))    show_usage();
+                    lod_threshold = std::atof( argv[i + 1]);
+                    i += 2;
+                    break;
 
-                    else if( strcmp( argv[i + 1], "rasterize") == 0)
-                        mode = RAST;
+                case 'f' :
+                    front_to_back = true;
+                    i += 1;
+                    break;
 
-                    else if( strcmp( argv[i + 1], "texture") == 0)
-                        mode = TEXTURE;
+                case 't' :
+                    show_stats = true;
+                    i += 1;
+                    break;
 
-                    else if( strcmp( argv[i + 1], "zbuf") == 0)
-                        mode = ZBUF;
+                case 'j' :
+                    if( (i + 1 >= argc) or (std::atoi( argv[i + 1]) <= 0))
+                        show_usage();
+                    n_threads = std::atoi( argv[i + 1]);
+                    i += 2;
+                    break;
+
+                case 'a' :
+                    pin_threads = true;
+                    i += 1;
+                    break;
+
+                case 'g' :
+                    sort_last = true;
+                    i += 1;
+                    break;
+
+                case 'q' :
+                    if( (i + 1 >= argc) or (std::atoi( argv[i + 1]) <= 0))
+                        show_usage();
+                    frames_in_flight = std::atoi( argv[i + 1]);
+                    i += 2;
+                    break;
+
+                case 'r' :
+                    if( (i + 1 >= argc) or (std::atoi( argv[i + 1]) < 0))
+                        show_usage();
+                    present_core = std::atoi( argv[i + 1]);
+                    i += 2;
+                    break;
+
+                case 'd' :
+                    if( (i + 1 >= argc) or (std::atof( argv[i + 1]) <= 0))
+                        show_usage();
+                    target_ms = std::atof( argv[i + 1]);
+                    i += 2;
+                    break;
+
+                case 'e' :
+                    if( (i + 1 >= argc) or (std::atoi( argv[i + 1]) <= 0) or
+                        (size_t( std::atoi( argv[i + 1])) > REFINE_SAMPLES_MAX))
+                        show_usage();
+                    progressive    = true;
+                    refine_samples = std::atoi( argv[i + 1]);
+                    i += 2;
+                    break;
+
+                case 'u' :
+                    reproject = true;
+                    i += 1;
+                    break;
+
+                case 'w' :
+                    if( (i + 1 >= argc) or
+                        (std::sscanf( argv[i + 1], "%dx%d",
+                                      &WIN_WIDTH, &WIN_HEIGHT) != 2) or
+                        (WIN_WIDTH <= 0) or (WIN_HEIGHT <= 0))
+                        show_usage();
+                    i += 2;
+                    break;
+
+                case 'b' :
+                    if( (i + 1 >= argc))    show_usage();
+                    batch_views = argv[i + 1];
+                    i += 2;
+                    break;
+
+                case 'i' :
+                    if( (i + 1 >= argc))    show_usage();
+                    batch_prefix = argv[i + 1];
+                    i += 2;
+                    break;
+
+                case 'x' :
+                    if( (i + 1 >= argc))    show_usage();
+
+                    if(      strcmp( argv[i + 1], "ppm") == 0)
+                        batch_format = image_writer::PPM;
+
+                    else if( strcmp( argv[i + 1], "qoi") == 0)
+                        batch_format = image_writer::QOI;
+
+                    else if( strcmp( argv[i + 1], "png") == 0)
+                        batch_format = image_writer::PNG;
 
                     else
                         show_usage();
 
-                    flag2 = true;
                     i += 2;
                     break;
 
+                case 'y' :
+                    if( (i + 1 >= argc))    show_usage();
+                    video_path = argv[i + 1];
+                    i += 2;
+                    break;
+
+                case 'n' :
+                    if( (i + 1 >= argc))    show_usage();
+                    ring_name = argv[i + 1];
+                    i += 2;
+                    break;
+
+                case 'z' :
+                    ring_depths = true;
+                    i += 1;
+                    break;
+
                 case 'h' :
                     show_usage();
                     break;
@@ -150,6 +326,17 @@
 
         }
 
+        // (the video is made of the batch frames)
+        if ( !video_path.empty() and batch_views.empty())
+            show_usage();
+
+        // (the samples are only shown, never written)
+        if ( !batch_views.empty() and flag0)
+            show_usage();
+
+        // (the depths go along with the frames)
+        if ( ring_depths and ring_name.empty())
+            show_usage();
 
         if ( !flag0 and flag1 and flag2)
             return;
@@ -196,7 +383,12 @@
             case RAST:
             case RAND:
             case TEXTURE:   
-                            dynamic_display();
+            case VISBUF:
+            case HIDDEN_LINE:
+                            if (batch_views.empty())
+                                dynamic_display();
+                            else
+                                batch_display();
                             break;
                             
                             
@@ -215,7 +407,9 @@
     
     void RTR::Window::static_display()
     {
-            draw_target (mode);
+            core->render( current_view(),
+                          { screen_buf, nullptr, WIN_WIDTH, nullptr});
+            present( screen_buf);
 
 
             SDL_Event event;
@@ -233,81 +427,162 @@
     
     
 
+    // Frame loop: sleeps while nothing happens, otherwise every tick
+    // folds all the queued input into one view and renders it
+    // (held keys keep moving the model at one step per HOLD_STEP_MS)
     void RTR::Window::dynamic_display()
     {
         SDL_Event event;
 
-        draw_target( mode);
+        // (the members only give the first view)
+        view_state view = current_view();
+
+        int X_ROT = 0;  // held rotation keys: -1, 0 or 1
+        int Y_ROT = 0;  //
+        int Z_ROT = 0;  //
+
+        start_pipeline();
+        view.input_ms = SDL_GetTicks();
+        submit_frame( view);
         
-        mode_t savedMode = mode;
+        mode_t savedMode = view.mode;
+        Uint32 last_tick = SDL_GetTicks();
+
+        // moves the view as far as the held keys got by <t>,
+        // false if none is held
+        auto hold = [&]( Uint32 t)
+        {
+            double k  = (t > last_tick) ? (t - last_tick) / HOLD_STEP_MS : 0;
+            last_tick = std::max( last_tick, t);
 
-        while ( SDL_WaitEvent( &event))
+            if (!(X_SPEED or Y_SPEED or Z_SPEED or X_ROT or Y_ROT or Z_ROT) or
+                (k == 0))
+                return false;
+
+            view.W_SHIFT += X_SPEED * k;
+            view.H_SHIFT += Y_SPEED * k;
+            view.D_SHIFT += Z_SPEED * k;
+
+            if (X_ROT) view.orientation = view.orientation * X_ROT_SPEED.pow( k * X_ROT);
+            if (Y_ROT) view.orientation = view.orientation * Y_ROT_SPEED.pow( k * Y_ROT);
+            if (Z_ROT) view.orientation = view.orientation * Z_ROT_SPEED.pow( k * Z_ROT);
+            view.orientation.normalize();
+            return true;
+        };
+
+        for (;;)
         {
-            switch(event.type)
+            bool moving = X_SPEED or Y_SPEED or Z_SPEED or X_ROT or Y_ROT or Z_ROT;
+
+            int got = moving
+                        ? SDL_WaitEventTimeout( &event, INPUT_TICK_MS)
+                        : SDL_WaitEvent( &event);
+            if (!got and !moving)
+                break;
+
+            bool    changed = false;
+            Uint32  input   = 0;    // the oldest input folded in
+
+            for (; got; got = SDL_PollEvent( &event))
             {
-                case SDL_QUIT : return;
+                if (event.type == frame_ready_event)
+                {
+                    present_ready();
+                    continue;
+                }
+
+                if (event.type == SDL_QUIT)
+                {
+                    stop_pipeline();
+                    return;
+                }
+
+                // (repeats are replaced by the ticks of held keys)
+                if (((event.type != SDL_KEYDOWN) and (event.type != SDL_KEYUP)) or
+                    event.key.repeat)
+                    continue;
+
+                // (a release only stops the motion, nothing to draw)
+                Uint32 t = event.common.timestamp;
+                if ((hold( t) or (event.type == SDL_KEYDOWN)) and !changed)
+                {
+                    input   = t;
+                    changed = true;
+                }
 
-                case SDL_KEYDOWN : switch( event.key.keysym.scancode)
+                if (event.type == SDL_KEYDOWN) switch( event.key.keysym.scancode)
                 {
-                    /* Translational motion */
+                    /* Translational motion: a step now, more while held */
                     case SDL_SCANCODE_W :
                                     Y_SPEED = -Y_SHIFT_SPEED_DEFAULT;
+                                    view.H_SHIFT += Y_SPEED;
                                     break;
                 
                     case SDL_SCANCODE_A :
                                     X_SPEED = -X_SHIFT_SPEED_DEFAULT;
+                                    view.W_SHIFT += X_SPEED;
                                     break;
 
                     case SDL_SCANCODE_S :
                                     Y_SPEED =  Y_SHIFT_SPEED_DEFAULT;
+                                    view.H_SHIFT += Y_SPEED;
                                     break;
 
                     case SDL_SCANCODE_D :
                                     X_SPEED =  X_SHIFT_SPEED_DEFAULT;
+                                    view.W_SHIFT += X_SPEED;
                                     break;
 
                     case SDL_SCANCODE_I :
                                     Z_SPEED =  Z_SHIFT_SPEED_DEFAULT;
+                                    view.D_SHIFT += Z_SPEED;
                                     break;
 
                     case SDL_SCANCODE_O :
                                     Z_SPEED =  -Z_SHIFT_SPEED_DEFAULT;
+                                    view.D_SHIFT += Z_SPEED;
                                     break;
                                    
                                    
                                    
                     /* Rotation: */          
                     case SDL_SCANCODE_5 :
-                                    orientation = 
-                                        orientation * X_ROT_SPEED;
+                                    view.orientation = 
+                                        view.orientation * X_ROT_SPEED;
+                                    X_ROT = 1;
                                     break;
                                     
                     case SDL_SCANCODE_6 :
-                                    orientation = 
-                                        orientation * 
+                                    view.orientation = 
+                                        view.orientation * 
                                             X_ROT_SPEED.get_reverse();
+                                    X_ROT = -1;
                                     break;
                                     
                     case SDL_SCANCODE_1 :
-                                    orientation = 
-                                        orientation * Y_ROT_SPEED;
+                                    view.orientation = 
+                                        view.orientation * Y_ROT_SPEED;
+                                    Y_ROT = 1;
                                     break;
                                     
                     case SDL_SCANCODE_2 :
-                                    orientation = 
-                                        orientation * 
+                                    view.orientation = 
+                                        view.orientation * 
                                             Y_ROT_SPEED.get_reverse();
+                                    Y_ROT = -1;
                                     break;
                                     
                     case SDL_SCANCODE_4 :
-                                    orientation = 
-                                        orientation * Z_ROT_SPEED;
+                                    view.orientation = 
+                                        view.orientation * Z_ROT_SPEED;
+                                    Z_ROT = 1;
                                     break;
                                     
                     case SDL_SCANCODE_3 :
-                                    orientation = 
-                                        orientation * 
+                                    view.orientation = 
+                                        view.orientation * 
                                             Z_ROT_SPEED.get_reverse();
+                                    Z_ROT = -1;
                                     break;
                                     
                                     
@@ -315,118 +590,163 @@
                                     
                     /* Rendering mode selection: */            
                     case SDL_SCANCODE_Z : 
-                                    if (mode != ZBUF)
+                                    if (view.mode != ZBUF)
                                     {
-                                        savedMode   = mode;
-                                        mode        = ZBUF;
+                                        savedMode   = view.mode;
+                                        view.mode   = ZBUF;
                                     }
                                     
-                                    else mode = savedMode;
+                                    else view.mode = savedMode;
                                     break;
                                     
                     case SDL_SCANCODE_X :
-                                    if (mode != WIREFRAME)
+                                    if (view.mode != WIREFRAME)
                                     {
-                                        savedMode   = mode;
-                                        mode        = WIREFRAME;
+                                        savedMode   = view.mode;
+                                        view.mode   = WIREFRAME;
                                     }
                                     
-                                    else mode = savedMode;
+                                    else view.mode = savedMode;
                                     break;
                                     
                     
                     case SDL_SCANCODE_C :
-                                    if (mode != RAST)
+                                    if (view.mode != RAST)
                                     {
-                                        savedMode   = mode;
-                                        mode        = RAST;
+                                        savedMode   = view.mode;
+                                        view.mode   = RAST;
                                     }
                                     
-                                    else mode = savedMode;
+                                    else view.mode = savedMode;
                                     break;
                                     
                     
                     case SDL_SCANCODE_V :
-                                    if (mode != TEXTURE)
+                                    if (view.mode != TEXTURE)
                                     {
-                                        savedMode   = mode;
-                                        mode        = TEXTURE;
+                                        savedMode   = view.mode;
+                                        view.mode   = TEXTURE;
                                     }
-                                    else mode = savedMode;
+                                    else view.mode = savedMode;
                                     break;
                                
                     case SDL_SCANCODE_B:
-                                    if (mode != RAND)
+                                    if (view.mode != RAND)
                                     {
-                                        savedMode   = mode;
-                                        mode        = RAND;
+                                        savedMode   = view.mode;
+                                        view.mode   = RAND;
                                     }
-                                    else mode = savedMode;
+                                    else view.mode = savedMode;
                                     break;
 
                     case SDL_SCANCODE_N:
-                                    if (mode != N_RM_RST)
+                                    if (view.mode != N_RM_RST)
+                                    {
+                                        savedMode   = view.mode;
+                                        view.mode   = N_RM_RST;
+                                    }
+                                    else view.mode = savedMode;
+                                    break;
+
+                    case SDL_SCANCODE_M:
+                                    if (view.mode != VISBUF)
+                                    {
+                                        savedMode   = view.mode;
+                                        view.mode   = VISBUF;
+                                    }
+                                    else view.mode = savedMode;
+                                    break;
+
+                    case SDL_SCANCODE_H:
+                                    if (view.mode != HIDDEN_LINE)
                                     {
-                                        savedMode   = mode;
-                                        mode        = N_RM_RST;
+                                        savedMode   = view.mode;
+                                        view.mode   = HIDDEN_LINE;
                                     }
-                                    else mode = savedMode;
+                                    else view.mode = savedMode;
+                                    break;
+
+                    case SDL_SCANCODE_P:
+                                    view.depth_prepass = !view.depth_prepass;
+                                    break;
+
+                    case SDL_SCANCODE_F:
+                                    view.front_to_back = !view.front_to_back;
+                                    break;
+
+                    case SDL_SCANCODE_K:
+                                    view.backface_culling = !view.backface_culling;
+                                    break;
+
+                    case SDL_SCANCODE_G:
+                                    view.sort_last = !view.sort_last;
+                                    break;
+
+                    case SDL_SCANCODE_E:
+                                    view.progressive = !view.progressive;
+                                    break;
+
+                    case SDL_SCANCODE_U:
+                                    view.reproject = !view.reproject;
                                     break;
                     default : break;
                 }
-                break;
 
 
-                case SDL_KEYUP :
-                    W_SHIFT += X_SPEED;
-                    H_SHIFT += Y_SPEED;
-                    D_SHIFT += Z_SPEED;
-                    
+                else switch( event.key.keysym.scancode)
+                {
+                    case SDL_SCANCODE_W:
+                                    if (Y_SPEED < 0) Y_SPEED = 0;
+                                    break;
+                                    
+                    case SDL_SCANCODE_A:
+                                    if (X_SPEED < 0) X_SPEED = 0;
+                                    break;
+                                    
+                    case SDL_SCANCODE_S:
+                                    if (Y_SPEED > 0) Y_SPEED = 0;
+                                    break;
                     
-                    draw_target( mode);
-                    switch( event.key.keysym.scancode)
-                    {
-                        case SDL_SCANCODE_W:
-                                        if (Y_SPEED < 0) Y_SPEED = 0;
-                                        break;
-                                        
-                        case SDL_SCANCODE_A:
-                                        if (X_SPEED < 0) X_SPEED = 0;
-                                        break;
-                                        
-                        case SDL_SCANCODE_S:
-                                        if (Y_SPEED > 0) Y_SPEED = 0;
-                                        break;
-                        
 
-                        case SDL_SCANCODE_D:
-                                        if (X_SPEED > 0) X_SPEED = 0;
-                                        break;
-                                        
-                        case SDL_SCANCODE_I:
-                                        if (Z_SPEED > 0) Z_SPEED = 0;
-                                        break;
-
-                        case SDL_SCANCODE_O:
-                                        if (Z_SPEED < 0) Z_SPEED = 0;
-                                        break;
-                                         
+                    case SDL_SCANCODE_D:
+                                    if (X_SPEED > 0) X_SPEED = 0;
+                                    break;
                                     
+                    case SDL_SCANCODE_I:
+                                    if (Z_SPEED > 0) Z_SPEED = 0;
+                                    break;
 
-                        default : break;
-                    }
-                    break;
-
-                default : break;
-            }
-
+                    case SDL_SCANCODE_O:
+                                    if (Z_SPEED < 0) Z_SPEED = 0;
+                                    break;
 
+                    case SDL_SCANCODE_5: if (X_ROT > 0) X_ROT = 0; break;
+                    case SDL_SCANCODE_6: if (X_ROT < 0) X_ROT = 0; break;
+                    case SDL_SCANCODE_1: if (Y_ROT > 0) Y_ROT = 0; break;
+                    case SDL_SCANCODE_2: if (Y_ROT < 0) Y_ROT = 0; break;
+                    case SDL_SCANCODE_4: if (Z_ROT > 0) Z_ROT = 0; break;
+                    case SDL_SCANCODE_3: if (Z_ROT < 0) Z_ROT = 0; break;
 
+                    default : break;
+                }
+            }
 
 
+            // Keys held since the last event:
+            if (hold( SDL_GetTicks()) and !changed)
+            {
+                input   = last_tick;
+                changed = true;
+            }
 
+            if (changed)
+            {
+                view.input_ms = input;
+                submit_frame( view);
+            }
         }
 
+        stop_pipeline();
         throw sdl_error();
     }
 //
@@ -435,429 +755,513 @@
 
 
 
-//  Rendering stuff:
 ///////////////////////////////////////////////////////////////////////////
-//  Switch:
+//  Frame pipeline:
 //
-    void RTR::Window::draw_target(mode_t m)
+    RTR::view_state RTR::Window::current_view() const
     {
-        clear_screen();
-        switch(m)
-        {
-            case N_RM_RST: 
-            case WIREFRAME:
-            case ZBUF:
-            case RAST:
-            case RAND:
-            case TEXTURE:   
-                            render_mode_threaded();
-                            break;
-                            
-                            
-            case TRIANGLE:  render_triangles();
-                            break;
+        view_state v;
+        v.mode              = mode;
+        v.orientation       = orientation;
+        v.W_SHIFT           = W_SHIFT;
+        v.H_SHIFT           = H_SHIFT;
+        v.D_SHIFT           = D_SHIFT;
+        v.depth_prepass     = depth_prepass;
+        v.front_to_back     = front_to_back;
+        v.backface_culling  = backface_culling;
+        v.sort_last         = sort_last;
+        v.progressive       = progressive;
+        v.reproject         = reproject;
+        return v;
+    }
 
-            case GOLD:      render_lines();
-                            break;
 
-            case NOT_GOLD:  render_lines();
-                            break;
 
+    // -d controller: the cost of a frame is mostly per pixel,
+    // so the side follows the square root of the frame time error
+    void RTR::Window::adapt_resolution( double frame_ms)
+    {
+        if (target_ms <= 0)
+            return;
 
-            default:        throw bad_mode();
-        }
+        if (frame_ms_avg > 0)
+            frame_ms_avg += RES_SMOOTHING * (frame_ms - frame_ms_avg);
+        else
+            frame_ms_avg = frame_ms;
 
-        SDL_RenderPresent( renderer);
+        double error = target_ms / frame_ms_avg;
+        if (std::abs( error - 1) < RES_DEADBAND)
+            return;
 
-        return;
+        double old_scale = res_scale;
+        res_scale = std::clamp( res_scale * std::clamp( std::sqrt( error),
+                                                1 / RES_MAX_STEP, RES_MAX_STEP),
+                                RES_SCALE_MIN, 1.);
+
+        // expected time at the new size, so the change is not made twice
+        double ratio = res_scale / old_scale;
+        frame_ms_avg *= ratio * ratio;
     }
 
 
-// Object display mode handler
-// Supports all the modes
-void RTR::Window::render_mode_threaded()
-{
 
-    zbuf_clear();
-    vec3d light(-1.0, .0, -1.0);
-    light.normalize();
+    void RTR::Window::start_pipeline()
+    {
+        frame_ready_event = SDL_RegisterEvents( 1);
+        if (frame_ready_event == static_cast<Uint32>( -1))
+            throw sdl_error();
+
+        targets.resize( frames_in_flight);
+        for (frame_target& t : targets)
+        {
+            t.pixels.resize( WIN_WIDTH * WIN_HEIGHT);
+            t.dirty = { 0, 0, WIN_WIDTH, WIN_HEIGHT};
+        }
+        free_targets.clear();
+        ready_targets.clear();
+        for (size_t k = 0; k < targets.size(); k++)
+            free_targets.push_back( k);
+
+        latency_max = 0;
+        latency_sum = 0;
+        presented   = 0;
+        dropped     = 0;
+
+        pending_view.reset();
+        render_error = nullptr;
+        pipe_stop    = false;
+        refining     = false;
+
+        render_thread = std::thread( &RTR::Window::render_loop, this);
+    }
 
-    int r = 0;
-    uint8_t red     = 0;
-    uint8_t green   = 0;
-    uint8_t blue    = 0;
-    uint8_t alpha   = 0;
 
-    size_t nfaces = model.nfaces();
-    auto retval = new tuple_triangle3i_double_bool[N_MACHINES];
 
-    for (size_t i = 0; i < model.nfaces(); i += N_MACHINES)
+    void RTR::Window::stop_pipeline()
     {
-        // Starting threads:
-        for (size_t j = 0; j < N_MACHINES; j++)
+        if (!render_thread.joinable())
+            return;
+
         {
-            if ((i + j) < nfaces)
-                pool[j] = std::thread( &RTR::Window::project_face,
-                                        this,
-                                        std::ref( retval),
-                                        j,
-                                        i + j,
-                                        light);
+            std::lock_guard<std::mutex> lock( pipe_m);
+            pipe_stop = true;
         }
+        pipe_cv.notify_all();
+        render_thread.join();
+    }
 
 
 
-        // Picking the result:
-        // (faces should be rendered in a single thread
-        //  because back-end may fail in another way)
-        for (size_t j = 0; j < N_MACHINES; j++)
+    // a newer view replaces the one that has not been started yet,
+    // so the queue never holds stale input
+    // (and the refinement of an older view is given up)
+    void RTR::Window::submit_frame( const view_state& v)
+    {
         {
-            if (pool[j].joinable())
-            {
-                pool[j].join();
+            std::lock_guard<std::mutex> lock( pipe_m);
+            pending_view = v;
+            if (refining)
+                cancel_frame = true;
+        }
+        pipe_cv.notify_all();
+    }
 
-                const triangle3i&    tr          = std::get<0>( retval[j]);
-                double              intensity   = std::get<1>( retval[j]);
-                bool                isOnScreen  = std::get<2>( retval[j]);
 
-                intensity *= intensity;
-                if ( isOnScreen ) try
-                {
-                    switch( mode)
-                    {
-                        case TEXTURE :
-                            if (intensity >= 0)
-                            {
-                                vec2i tv[3];
-                                for( size_t k = 0; k < 3; ++k)
-                                    tv[k] = model.tv(i + j, k);
-
-                                draw_triangle( tr[0], tr[1], tr[2],
-                                               tv[0], tv[1], tv[2],
-                                               intensity);
-                            }
-                            break;
 
+    // Halton sequence: the digits of <i> mirrored around the point
+    static double radical_inverse( size_t i, size_t base)
+    {
+        double res = 0;
+        for (double f = 1. / base; i > 0; i /= base, f /= base)
+            res += f * (i % base);
+        return res;
+    }
 
 
-                        case ZBUF :
-                                SDL_SetRenderDrawColor( renderer,
-                                                        0, 0,
-                                                        0, 0);
-                                draw_triangle(  tr[0],  tr[1],  tr[2]); // filling zbuf;
-                                break;
-                                
-                                
-
-                        case RAST :
-                            if (intensity >= 0)
-                            {
-                                red = green = blue = alpha = intensity * 255u;
-                                SDL_SetRenderDrawColor( renderer,
-                                                        red, green,
-                                                        blue, alpha);
-                                draw_triangle(  tr[0],  tr[1],  tr[2]);
-                            }
-                            break;
-                            
-                            
-                            
-                        case RAND : 
-                            {
-                                r       = std::rand();
-                                red     = r % 256;
-                                green   = (r >> 8)  % 256;
-                                blue    = (r >> 16) % 256;
-                                alpha   = (r >> 24) % 256;
-                                SDL_SetRenderDrawColor( renderer,
-                                                        red, green,
-                                                        blue, alpha);
-                                draw_triangle(  tr[0],  tr[1],  tr[2]);
-                            }
-                            break;
-                            
-                            
-                            
-                        case WIREFRAME :
-                            SDL_SetRenderDrawColor( renderer, 255u, 255u, 255u, 255u);
-                            draw_line( tr[0].x, tr[0].y, tr[1].x, tr[1].y);
-                            draw_line( tr[0].x, tr[0].y, tr[2].x, tr[2].y);
-                            draw_line( tr[2].x, tr[2].y, tr[1].x, tr[1].y);
-                            break;
-                            
-                            
-                            
-                        case N_RM_RST :
-                            if (intensity >= 0)
-                            {
-                                red = green = blue = alpha = intensity * 255u;
-                                SDL_SetRenderDrawColor( renderer,
-                                                        red, green,
-                                                        blue, alpha);
-                                draw_triangle( vec2i(tr[0].x, tr[0].y), 
-                                            vec2i(tr[1].x, tr[1].y),
-                                            vec2i(tr[2].x, tr[2].y));
-                            }
-                             
-                             break;
-                      default : break;
-                    }
-                }
 
-                catch( std::exception& e)
-                {
-                    for ( ; j < N_MACHINES; j++)
-                        if (pool[j].joinable()) pool[j].join();
-                    throw e;
-                }
+    // Render thread: waits for a view and a free target,
+    // draws and hands the target over to the main thread;
+    // with nothing new to draw it refines the last view
+    void RTR::Window::render_loop()
+    {
+        view_state  v;
+        size_t      level   = 0;
+        size_t      levels  = 0;    // frames to draw of v
 
-                catch(...)
+        for (;;)
+        {
+            size_t k;
+            {
+                std::unique_lock<std::mutex> lock( pipe_m);
+                pipe_cv.wait( lock, [&]
                 {
-                    for ( ; j < N_MACHINES; j++)
-                        if (pool[j].joinable()) pool[j].join();
+                    return pipe_stop or
+                           ((pending_view or (level < levels)) and
+                            !free_targets.empty());
+                });
+
+                if (pipe_stop)
+                    return;
 
-                    throw std::runtime_error(
-                                    "draw_triangle() failed");
+                if (pending_view)
+                {
+                    v = *pending_view;
+                    pending_view.reset();
+                    level  = 0;
+                    levels = v.progressive ? refine_levels( v.mode) : 1;
                 }
-            }
-            
-        }
 
-    }
+                k = free_targets.front();
+                free_targets.pop_front();
+                targets[k].input_ms = v.input_ms;
+                targets[k].refined  = (level > 0);
 
-    if ( mode == ZBUF)
-        display_zbuf();
+                refining     = (level > 0);
+                cancel_frame = false;
+            }
 
-    delete [] retval;
-    return;
-}
+            bool preview = v.progressive and (level == 0);
+            try
+            {
+                auto t0 = std::chrono::steady_clock::now();
+
+                // Preview: flat shading, fewer pixels;
+                // refinement: every pixel, filtered, sample <level - 1>
+                view_state f = v;
+                if (preview and ((f.mode == TEXTURE) or (f.mode == VISBUF)))
+                    f.mode = RAST;
+
+                if (!v.progressive)
+                    core->set_resolution( res_scale);
+                else if (preview)
+                    core->set_resolution( res_scale * PREVIEW_SCALE);
+                else
+                    core->set_resolution( 1.);
+
+                double jx = 0, jy = 0;
+                if ((levels > 2) and (level > 0))
+                {
+                    jx = radical_inverse( level, 2) - 0.5;
+                    jy = radical_inverse( level, 3) - 0.5;
+                }
+                core->set_sample( jx, jy, v.progressive and !preview);
+
+                uint32_t* pixels = targets[k].pixels.data();
+                targets[k].rect = SDL_Rect{ 0, 0, core->view_width(),
+                                                  core->view_height()};
+                const frame_stats& stats =
+                    core->render( f, { pixels, nullptr, WIN_WIDTH,
+                                       &targets[k].dirty});
+                double ms = std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - t0).count();
+
+                if (show_stats and !cancel_frame)
+                {
+                    print_stats( stats, f, v.progressive ? level : 0);
 
+                    if (auto e = core->check_reprojection())
+                        std::cout << "reprojection error: " << e->pixels << "% pixels"
+                                  << "\tmean: " << e->mean << " (of 255)"
+                                  << std::endl;
+                }
 
-  //  std::cout<<"z_"<<z<<std::endl;
-
-
-
-// Thread routine:
-// using macro because of the need of founding xmin, xmax, ...
-#define project_vertice(/* vec3d world[j] */)\
-{               \
-    /* Rotate: */                                                        \
-    orientation.rotate( world[j]);\
-                                                                        \
-    /* Shift: */                                                \
-    world[j].x = model.xshift() - world[j].x + W_SHIFT;         \
-    world[j].y = model.yshift() - world[j].y + H_SHIFT;         \
-    world[j].z = model.zshift() - world[j].z + D_SHIFT;         \
-                                                                    \
-    /* Perspective: */                                              \
-    double div = PERSPECTIVE_FOCUS * world[j].z + 1;                \
-    if (div < 0.1)                                                  \
-        div = 0.1;                                                  \
-                                                                    \
-    world[j].x /= div;                                              \
-    world[j].y /= div;                                              \
-                                                                    \
-    x = ( world[j].x) * OBJ_SCALE                                   \
-                                                + WIN_WIDTH / 2.0;  \
-                                                                    \
-    y = ( world[j].y) * OBJ_SCALE                                   \
-                                                + WIN_HEIGHT / 2.0; \
-                                                                    \
-    double tempz =  (  world[j].z)  * ZBUF_SCALE;                   \
-    if ( tempz >= std::numeric_limits<zbuf_depth_t>::max() )        \
-        z = std::numeric_limits<zbuf_depth_t>::max();               \
-                                                                    \
-    if ( tempz <= std::numeric_limits<zbuf_depth_t>::min() )        \
-        z = std::numeric_limits<zbuf_depth_t>::min();               \
-                                                                    \
-    else                                                            \
-        z = tempz;                                                  \
-                                                                    \
-}
- 
+                if ((levels > 2) and (level > 0) and !cancel_frame)
+                    core->accumulate( level);
 
+                if (ring and !cancel_frame)
+                    ring->publish( pixels, core->depths(), core->view_width(),
+                                   core->view_height(), WIN_WIDTH);
 
-// (supports parallelization)
-void RTR::Window::project_face( tuple_triangle3i_double_bool*& info,
-                                size_t infoIDX,
-                                size_t i,
-                                const vec3d& light)
-{
+                // (the next frame may get another resolution)
+                if (level == 0)
+                    adapt_resolution( ms);
+            }
 
-    auto face =  model.face(i);
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock( pipe_m);
+                render_error = std::current_exception();
+            }
 
-    triangle3i projection;
+            bool cancelled = cancel_frame;
+            level++;
+            {
+                std::lock_guard<std::mutex> lock( pipe_m);
+                refining = false;
+                if (cancelled)
+                {
+                    free_targets.push_back( k);
+                    continue;
+                }
+                ready_targets.push_back( k);
+            }
 
-    bool    isOnScreen  = true;
-    int     xmin        = WIN_WIDTH;
-    int     xmax        = 0;
-    int     ymin        = WIN_HEIGHT;
-    int     ymax        = 0;
+            SDL_Event event;
+            std::memset( &event, 0, sizeof( event));
+            event.type = frame_ready_event;
+            SDL_PushEvent( &event);
+        }
+    }
 
 
-    vec3d world[3];
 
-    for(size_t j = 0; j < 3; ++j)
+    // frames drawn of a view: the preview, then one per sample
+    // (RAND colors change every frame, nothing to average)
+    size_t RTR::Window::refine_levels( mode_t m) const
     {
-        world[j] = model.vertice(face[j]);
-        int     x, y, z;
-
-        project_vertice();       // "fills" x, y, z;
-
-        if (xmin > x) xmin = x;
-        if (xmax < x) xmax = x;
-        if (ymin > y) ymin = y;
-        if (ymax < y) ymax = y;
-
-        projection[j] = vec3i( x, y, z);
+        return 1 + ((m == RAND) ? 1 : refine_samples);
     }
 
-    vec3d n = (world[2] - world[0]) ^ (world[1] - world[0]);
-    n.normalize();
-    double intensity = n * light;
-
-    assert( intensity <= 1);
 
 
-    if ( (xmin > WIN_WIDTH) or (xmax < 0))
-        isOnScreen = false;
+    // Main thread: shows the newest finished frame, older ones are dropped
+    void RTR::Window::present_ready()
+    {
+        std::exception_ptr  error;
+        size_t              k = 0;
+        bool                found = false;
+        {
+            std::lock_guard<std::mutex> lock( pipe_m);
+            std::swap( error, render_error);
 
-    if ( (ymin > WIN_HEIGHT) or (ymax < 0))
-        isOnScreen = false;
+            while (!ready_targets.empty())
+            {
+                if (found)
+                {
+                    free_targets.push_back( k);
+                    dropped += !targets[k].refined;
+                }
+                k     = ready_targets.front();
+                found = true;
+                ready_targets.pop_front();
+            }
+        }
 
-    info[ infoIDX] = std::make_tuple( projection, intensity, isOnScreen);
+        if (found)
+        {
+            // (the target is free again once SDL has a copy)
+            present( targets[k].pixels.data(), &targets[k].rect,
+                     &targets[k].dirty);
 
-    return;
+            // (a refined frame answers no input)
+            Uint32 latency = SDL_GetTicks() - targets[k].input_ms;
+            if (!targets[k].refined)
+            {
+                latency_max  = std::max( latency_max, latency);
+                latency_sum += latency;
+                presented++;
+            }
 
-}
+            {
+                std::lock_guard<std::mutex> lock( pipe_m);
+                free_targets.push_back( k);
+            }
+            pipe_cv.notify_all();
+
+            if (show_stats and !targets[k].refined)
+                std::cout << "latency: "   << latency << " ms"
+                          << "\tavg: "     << latency_sum / presented << " ms"
+                          << "\tmax: "     << latency_max << " ms"
+                          << "\tdropped: " << dropped << "/"
+                                           << presented + dropped
+                          << "\tuploaded: " << bytes_uploaded / 1024 << " KiB"
+                          << std::endl;
+        }
 
-#undef project_vertice
+        if (error)
+            std::rethrow_exception( error);
+    }
 //
 //
 ///////////////////////////////////////////////////////////////////////////
 
 
 
-
-
-
 ///////////////////////////////////////////////////////////////////////////
-// Render samples:
+//  Batch:
 //
-void RTR::Window::render_lines()
-{
-    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-    SDL_RenderDrawPoint(renderer, WIN_WIDTH / 2, WIN_HEIGHT / 2);
+    // -b: a turntable of that many frames or the views listed in a file
+    void RTR::Window::batch_display()
+    {
+        render_batch( batch_list(), batch_prefix, batch_format, video_path);
+    }
 
-    bool ok = true;
-    int fib = 1, prev_fib = 0;
-    int new_x = WIN_WIDTH / 2, new_y = WIN_HEIGHT / 2,
-        prev_x = WIN_WIDTH / 2, prev_y = WIN_HEIGHT / 2;
-    bool gold = (mode == GOLD);
 
-    while(ok)
-    {
-        draw_line( prev_x, prev_y, new_x, new_y);
 
-        if(gold)
-        {
-            fib += prev_fib;
-            prev_fib = fib;
-        }
-        else
+    // Turntable: a Y_ROT_SPEED_DEFAULT step between the frames
+    std::vector<RTR::view_state> RTR::Window::turntable( const view_state& first,
+                                                         size_t frames)
+    {
+        std::vector<view_state> res( frames, first);
+        for (size_t k = 1; k < frames; k++)
         {
-            prev_fib = fib++;
+            res[k].orientation = res[k - 1].orientation * Y_ROT_SPEED_DEFAULT;
+            res[k].orientation.normalize();
         }
-        prev_x = new_x;
-        prev_y = new_y;
-        static int i = 0;
-        switch(i++)
+
+        return res;
+    }
+
+
+
+    // A view per line: "w x y z" of the orientation, then optionally
+    // the three shifts (the ones of the command line otherwise),
+    // empty lines and the ones starting with '#' are skipped
+    std::vector<RTR::view_state> RTR::Window::batch_list() const
+    {
+        char* end = nullptr;
+        long  n   = std::strtol( batch_views.c_str(), &end, 10);
+        if ((*end == 0) and (n > 0))
+            return turntable( current_view(), n);
+
+        std::ifstream ifs( batch_views);
+        if (ifs.fail())
+            throw std::ios_base::failure( "Can't open views file " + batch_views);
+
+        std::vector<view_state> res;
+        std::string line;
+        while (std::getline( ifs, line))
         {
-            case 0:
-                new_x = prev_x + fib;
-                new_y = prev_y - fib;
-                break;
-            case 1:
-                new_x = prev_x + fib;
-                new_y = prev_y + fib;
-                break;
-            case 2:
-                new_x = prev_x - fib;
-                new_y = prev_y + fib;
-                break;
-            case 3:
-                new_x = prev_x - fib;
-                new_y = prev_y - fib;
-                break;
+            if ((line.find_first_not_of( " \t\r") == std::string::npos) or
+                (line[ line.find_first_not_of( " \t")] == '#'))
+                continue;
+
+            view_state v = current_view();
+            std::istringstream is( line);
+            if (!(is >> v.orientation.w >> v.orientation.x
+                     >> v.orientation.y >> v.orientation.z))
+                throw std::runtime_error( "Bad view: " + line);
+
+            is >> v.W_SHIFT >> v.H_SHIFT >> v.D_SHIFT;
+            v.orientation.normalize();
+            res.push_back( v);
         }
 
-        i %= 4;
+        return res;
+    }
+
+
+
+    // The views are shared out between batch workers, one a thread:
+    // each one draws whole frames with a Renderer, buffers and a
+    // scheduler of its own (its frames never wait for the tasks of
+    // another one) and encodes and writes its images itself; the video,
+    // the shared memory ring and the statistics take the frames in order
+    void RTR::Window::render_batch( const std::vector<view_state>& views,
+                                    const std::string& prefix,
+                                    image_writer::format_t format,
+                                    const std::string& video)
+    {
+        size_t nbatch = std::min( workers->size(), std::max<size_t>( views.size(), 1));
+
+        std::unique_ptr<y4m_writer> stream;
+        if (!video.empty())
+            stream = std::make_unique<y4m_writer>( video, WIN_WIDTH, WIN_HEIGHT,
+                                                   VIDEO_FPS);
+
+        std::atomic<size_t>     next{0};        // view to draw
+        std::mutex              m;
+        std::condition_variable turn_cv;
+        size_t                  turn    = 0;    // (under m) view to hand over
+        bool                    failed  = false;
+        double encode_sum = 0, write_sum = 0;   // (under m)
 
-        if (( (new_x < 0) || (new_x > WIN_WIDTH) )
-                        || ( (new_y < 0) || (new_y > WIN_HEIGHT)))
+        auto batch_worker = [&]
         {
-            if(new_x < 0)
+            scheduler               own( 1);
+            Renderer                batch_core( *model, WIN_WIDTH, WIN_HEIGHT, own);
+            image_writer            images( format, &own);
+            std::vector<uint32_t>   buf( WIN_WIDTH * WIN_HEIGHT);
+            screen_rect             dirty{ 0, 0, WIN_WIDTH, WIN_HEIGHT};
+            batch_core.set_lod_threshold( lod_threshold);
+
+            try
             {
-                new_y = new_y + new_x * (new_y - prev_y)
-                                        / (double) (new_x - prev_x);
-                new_x = 0;
-            }
-            if(new_x > WIN_WIDTH)
-            {
-                new_y = new_y - (new_x - WIN_WIDTH) *
-                                (new_y - prev_y) /
-                                (double) (new_x - prev_x);
-                new_x = WIN_WIDTH;
-            }
+                for (size_t k = next++; k < views.size(); k = next++)
+                {
+                    // (every frame is drawn in full, on its own)
+                    view_state v  = views[k];
+                    v.progressive = false;
+                    v.reproject   = false;
 
-            if(new_y < 0)
-            {
-                new_x = new_x + new_y *
-                                (new_x - prev_x) /
-                                (double) (new_y - prev_y);
-                new_y = 0;
-            }
-            if(new_y > WIN_HEIGHT)
-            {
-                new_x = new_x - (new_y - WIN_HEIGHT) *
-                                (new_x - prev_x) /
-                                (double) (new_y - prev_y);
-                new_y = WIN_HEIGHT;
-            }
+                    const frame_stats& stats =
+                        batch_core.render( v, { buf.data(), nullptr, WIN_WIDTH,
+                                                &dirty});
 
-            draw_line( prev_x, prev_y, new_x, new_y);
+                    double encode_ms = 0, write_ms = 0;
+                    if (!stream)
+                    {
+                        char name[32];
+                        std::snprintf( name, sizeof( name), "_%04zu.%s", k,
+                                       images.extension());
+                        images.write( prefix + name, buf.data(),
+                                      batch_core.view_width(),
+                                      batch_core.view_height(), WIN_WIDTH);
+                        encode_ms = images.encode_ms();
+                        write_ms  = images.write_ms();
+                    }
 
-            ok = false;
-        }
-    }
+                    std::unique_lock<std::mutex> lock( m);
+                    turn_cv.wait( lock, [&] { return failed or (turn == k); });
+                    if (failed)
+                        return;
 
-    return;
-}
+                    if (show_stats)
+                        print_stats( stats, v, 0);
 
+                    if (ring)
+                        ring->publish( buf.data(), batch_core.depths(),
+                                       batch_core.view_width(),
+                                       batch_core.view_height(), WIN_WIDTH);
+
+                    // (a video frame is converted as it is written)
+                    if (stream)
+                    {
+                        auto w0 = std::chrono::steady_clock::now();
+                        stream->write( buf.data(), WIN_WIDTH);
+                        write_ms = std::chrono::duration<double, std::milli>(
+                                       std::chrono::steady_clock::now() - w0).count();
+                    }
 
+                    encode_sum += encode_ms;
+                    write_sum  += write_ms;
+                    if (show_stats)
+                        std::cout << "encode: " << encode_ms << " ms"
+                                  << "\twrite: " << write_ms << " ms" << std::endl;
 
-void RTR::Window::render_triangles()
-{
-    vec3i v1(100, 400, -10);
-    vec3i v2(700, 250, -1);
-    vec3i v3(700, 550, -1);
-    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-    draw_triangle( v1, v2, v3);
-
-    v1 = vec3i(300, 100, -5);
-    v2 = vec3i(300, 700, -5);
-    v3 = vec3i(525, 400, -1);
-    SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-    draw_triangle( v1, v2, v3);
-
-    v1 = vec3i(600, 50, -5);
-    v2 = vec3i(600, 750, -5);
-    v3 = vec3i(475, 400, -1);
-    SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
-    draw_triangle( v1, v2, v3);
+                    turn++;
+                    turn_cv.notify_all();
+                }
+            }
 
-    return;
-}
+            catch (...)
+            {
+                // (the others stop at their next frame)
+                {
+                    std::lock_guard<std::mutex> lock( m);
+                    failed = true;
+                }
+                turn_cv.notify_all();
+                throw;
+            }
+        };
+
+        auto t0 = std::chrono::steady_clock::now();
+
+        // (the waiting thread runs one of them too)
+        scheduler::group batch;
+        for (size_t i = 0; i < nbatch; i++)
+            workers->spawn( batch, batch_worker);
+        workers->wait( batch);
+
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - t0).count();
+        size_t n = std::max<size_t>( views.size(), 1);
+        std::cout << "batch: " << views.size() << " frames in " << ms << " ms"
+                  << " (" << ms / n << " ms a frame, encode "
+                  << encode_sum / n << " ms, write " << write_sum / n << " ms)"
+                  << std::endl;
+    }
 //
 //
 ///////////////////////////////////////////////////////////////////////////
@@ -867,78 +1271,103 @@ void RTR::Window::render_triangles()
 
 
 ///////////////////////////////////////////////////////////////////////////
-// MISC
+// Output:
 //
-void RTR::Window::zbuf_clear()
+void RTR::Window::print_stats( const frame_stats& stats, const view_state& v,
+                               size_t level) const
 {
-    assert( zbuf != nullptr);
-
-    #ifdef USE_MEMSET
-    memset( zbuf, -127, WIN_HEIGHT * WIN_WIDTH * sizeof(zbuf_depth_t));
-    #else
-    for(int i = 0; i < WIN_HEIGHT; ++i)
-        for(int j = 0; j < WIN_WIDTH; ++j)
-               zbuf[j + i * WIN_WIDTH] =
-                        std::numeric_limits<zbuf_depth_t>::min();
-    #endif
-    return;
-}
+    std::cout << "depth tests: "    << stats.depth_tests
+              << "\tdepth writes: "  << stats.depth_writes
+              << "\ttexel fetches: " << stats.texel_fetches;
 
+    if (v.depth_prepass and (v.mode == TEXTURE))
+        std::cout << "\tsaved by prepass: " << stats.texel_fetches_saved;
 
-void RTR::Window::display_zbuf()
-{
-    if (zbuf != nullptr )
-    {
-        long long max_distance  = zbuf_max - zbuf_min;
-        for (int y = 0; y < WIN_HEIGHT; y++)
-            for (int x = 0; x < WIN_WIDTH; x++)
-            {
+    std::cout << "\tlod: "   << stats.lod
+              << " ("       << stats.faces << " faces)";
 
-                int color;
-                switch( zbuf[x + y * WIN_WIDTH])
-                {
-                    case std::numeric_limits<zbuf_depth_t>::min() : 
-                        color = 0;
-                        break;
-                        
-                    case std::numeric_limits<zbuf_depth_t>::max() :
-                        color = 255;
-                        break;
-                        
-                    default :
-                    {
-                        long long distance = ( ((long long)zbuf[x + y * WIN_WIDTH]) - zbuf_min);
-                        double k = 255 / (double) max_distance;
+    std::cout << "\tclusters culled: " << stats.clusters_culled
+              << "/"                  << stats.clusters;
 
-                        color =  distance * k;
-                        break;
-                    }
-                }
-                             
-            
-                assert(color <= 255);
+    std::cout << "\tsort: "   << stats.sort_ms   << " ms"
+              << "\traster: " << stats.raster_ms << " ms";
 
-                SDL_SetRenderDrawColor( renderer, color, color, color, color);
-                SDL_RenderDrawPoint( renderer, x, y);
-            }
-    }
-    
-    return;
+    if (stats.composite_ms > 0)
+        std::cout << " (composite: " << stats.composite_ms << " ms)";
+
+    std::cout << "\ttasks: "  << stats.tasks
+              << "\tsteals: " << stats.steals
+              << "\tidle: "   << stats.idle_ms << " ms";
+
+    std::cout << "\tcleared: " << stats.bytes_cleared / 1024 << " KiB";
+
+    if ((v.mode == WIREFRAME) or (v.mode == HIDDEN_LINE))
+        std::cout << "\tpixel writes: " << stats.pixel_writes;
+
+    if (ring)
+        std::cout << "\tshared: " << ring->published()
+                  << " (" << ring->dropped() << " dropped)";
+
+    if (target_ms > 0)
+        std::cout << "\tres: "   << stats.res_scale
+                  << " ("        << core->view_width() << "x" << core->view_height()
+                  << ", avg "    << frame_ms_avg << " ms)";
+
+    if (stats.tiles > 0)
+        std::cout << "\treprojected, redrawn: " << stats.tiles_redrawn
+                                              << "/" << stats.tiles << " tiles";
+
+    if (v.progressive)
+        std::cout << "\trefine: " << level << "/"
+                                  << refine_levels( v.mode) - 1;
+
+    std::cout << std::endl;
 }
 
 
 
-void RTR::Window::clear_screen()
+
+
+// uploads a color buffer and shows it,
+// only its top left <rect> stretched over the window if given;
+// with the <dirty> part of the buffer known only that
+// and what the texture showed last are uploaded
+void RTR::Window::present( const uint32_t* pixels, const SDL_Rect* rect,
+                           const screen_rect* dirty)
 {
-    if( SDL_SetRenderDrawColor(renderer, R_BGR,
-                                         G_BGR,
-                                         B_BGR,
-                                         A_BGR) < 0 )
-    throw sdl_error();
+    if (dirty)
+    {
+        // (both are background elsewhere)
+        screen_rect r = tex_dirty;
+        r.unite( *dirty);
+
+        SDL_Rect u{ r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0};
+        if ( !r.empty() and
+             (SDL_UpdateTexture( frame, &u, pixels + r.x0 + r.y0 * WIN_WIDTH,
+                                 WIN_WIDTH * sizeof(uint32_t)) < 0))
+             throw sdl_error();
+
+        bytes_uploaded = r.area() * sizeof(uint32_t);
+        tex_dirty      = *dirty;
+    }
 
-    if ( SDL_RenderClear(renderer) < 0)
+    else
+    {
+        if ( SDL_UpdateTexture( frame, rect, pixels,
+                                WIN_WIDTH * sizeof(uint32_t)) < 0)
+             throw sdl_error();
+
+        bytes_uploaded = (rect ? rect->w * rect->h : WIN_WIDTH * WIN_HEIGHT) *
+                         sizeof(uint32_t);
+        tex_dirty      = { 0, 0, WIN_WIDTH, WIN_HEIGHT};
+    }
+
+    if ( SDL_RenderCopy( renderer, frame, rect, nullptr) < 0)
          throw sdl_error();
 
+    SDL_RenderPresent( renderer);
+
+    return;
 }
 //
 //
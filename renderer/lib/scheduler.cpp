@@ -0,0 +1,411 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace
+{
+    // which scheduler the current thread works for and its deque there
+    thread_local const RTR::scheduler*  tl_owner = nullptr;
+    thread_local size_t                 tl_index = 0;
+
+    // what the tasks run by the current thread count into
+    thread_local RTR::scheduler::tally* tl_tally = nullptr;
+
+    int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Constructor/Destructor:
+//
+    RTR::scheduler::scheduler( size_t nthreads, const std::vector<size_t>& cores)
+    {
+        size_t nworkers = (nthreads > 1) ? nthreads - 1 : 0;
+
+        for (size_t i = 0; i <= nworkers; i++)
+            queues.push_back( std::make_unique<worker_queue>());
+
+        for (size_t i = 0; i < nworkers; i++)
+        {
+            bool   pin  = !cores.empty();
+            size_t core = pin ? cores[i % cores.size()] : 0;
+
+            threads.emplace_back( [this, i, pin, core]
+            {
+                if (pin)
+                    pin_to_core( core);
+                worker_loop( i);
+            });
+        }
+    }
+
+
+
+    RTR::scheduler::~scheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock( idle_m);
+            stop = true;
+        }
+        idle_cv.notify_all();
+
+        for (auto& t : threads)
+            t.join();
+    }
+
+
+
+
+    bool RTR::scheduler::pin_to_core( size_t core)
+    {
+    #ifdef __linux__
+        if (core >= CPU_SETSIZE)
+            return false;
+
+        cpu_set_t set;
+        CPU_ZERO( &set);
+        CPU_SET( core, &set);
+        return pthread_setaffinity_np( pthread_self(), sizeof( set), &set) == 0;
+    #else
+        (void) core;
+        return false;
+    #endif
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Tasks:
+//
+    size_t RTR::scheduler::self() const
+    {
+        return (tl_owner == this) ? tl_index : threads.size();
+    }
+
+
+
+    void RTR::scheduler::spawn( group& g, std::function<void()> fn)
+    {
+        g.pending++;
+
+        // (counted before it is pushed: a thief taking it at once
+        // can't bring the count below the tasks queued)
+        {
+            std::lock_guard<std::mutex> lock( idle_m);
+            queued++;
+        }
+
+        worker_queue& q = *queues[ self()];
+        {
+            std::lock_guard<std::mutex> lock( q.m);
+            q.tasks.push_back( task{ std::move( fn), &g, tl_tally});
+        }
+        idle_cv.notify_one();
+    }
+
+
+
+    // own deque from the back, the others from the front
+    bool RTR::scheduler::try_run( size_t self)
+    {
+        task t;
+        bool found  = false;
+        bool stolen = false;
+
+        {
+            worker_queue& q = *queues[ self];
+            std::lock_guard<std::mutex> lock( q.m);
+            if (!q.tasks.empty())
+            {
+                t = std::move( q.tasks.back());
+                q.tasks.pop_back();
+                found = true;
+            }
+        }
+
+        for (size_t k = 1; !found and (k < queues.size()); k++)
+        {
+            worker_queue& q = *queues[ (self + k) % queues.size()];
+            std::lock_guard<std::mutex> lock( q.m);
+            if (!q.tasks.empty())
+            {
+                t = std::move( q.tasks.front());
+                q.tasks.pop_front();
+                found  = true;
+                stolen = true;
+                queues[ self]->stolen++;
+            }
+        }
+
+        if (!found)
+            return false;
+
+        queued--;
+        run( self, t, stolen);
+        return true;
+    }
+
+
+
+    void RTR::scheduler::run( size_t self, task& t, bool stolen)
+    {
+        // (what the task spawns counts where the task does)
+        tally* outer = tl_tally;
+        tl_tally = t.t;
+
+        try
+        {
+            t.fn();
+        }
+
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock( t.g->error_m);
+            if (!t.g->error)
+                t.g->error = std::current_exception();
+        }
+
+        tl_tally = outer;
+
+        queues[ self]->ran++;
+        if (t.t)
+        {
+            t.t->tasks++;
+            if (stolen)
+                t.t->steals++;
+        }
+
+        t.g->pending--;
+    }
+
+
+
+    void RTR::scheduler::worker_loop( size_t id)
+    {
+        tl_owner = this;
+        tl_index = id;
+
+        for (;;)
+        {
+            if (try_run( id))
+                continue;
+
+            int64_t t0 = now_ns();
+            {
+                std::unique_lock<std::mutex> lock( idle_m);
+                if (stop)
+                    return;
+
+                if (queued == 0)
+                {
+                    queues[ id]->idle_waits++;
+                    idle_cv.wait( lock, [this]
+                                  { return stop or (queued > 0); });
+                }
+            }
+            // (sleeping since before reset_stats() counts from there)
+            int64_t since = std::max<int64_t>( t0, epoch_ns);
+            int64_t until = now_ns();
+            if (until > since)
+                queues[ id]->idle_ns += until - since;
+        }
+    }
+
+
+
+    void RTR::scheduler::wait( group& g)
+    {
+        size_t  me      = self();
+        tally*  mine    = tl_tally;
+        int64_t idle_t0 = 0;    // since nothing was found to run, 0: running
+
+        while (g.pending > 0)
+        {
+            if (try_run( me))
+            {
+                if (mine and idle_t0)
+                    mine->idle_ns += now_ns() - idle_t0;
+                idle_t0 = 0;
+                continue;
+            }
+
+            if (mine and !idle_t0)
+            {
+                idle_t0 = now_ns();
+                mine->idle_waits++;
+            }
+            std::this_thread::yield();
+        }
+
+        if (mine and idle_t0)
+            mine->idle_ns += now_ns() - idle_t0;
+
+        if (g.error)
+        {
+            std::exception_ptr e = g.error;
+            g.error = nullptr;
+            std::rethrow_exception( e);
+        }
+    }
+
+
+
+    void RTR::scheduler::parallel_for( size_t begin, size_t end, size_t grain,
+                        const std::function<void(size_t, size_t)>& body)
+    {
+        if (grain == 0)
+            grain = 1;
+
+        group g;
+        for (size_t b = begin; b < end; b += grain)
+        {
+            size_t e = std::min( end, b + grain);
+            spawn( g, [&body, b, e] { body( b, e); });
+        }
+
+        wait( g);
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Statistics:
+//
+    RTR::scheduler::counters RTR::scheduler::stats() const
+    {
+        counters res;
+        for (auto& q : queues)
+        {
+            res.tasks       += q->ran;
+            res.steals      += q->stolen;
+            res.idle_waits  += q->idle_waits;
+            res.idle_ms     += q->idle_ns / 1e6;
+        }
+
+        return res;
+    }
+
+
+
+    RTR::scheduler::counters RTR::scheduler::tally::get() const
+    {
+        counters res;
+        res.tasks       = tasks;
+        res.steals      = steals;
+        res.idle_waits  = idle_waits;
+        res.idle_ms     = idle_ns / 1e6;
+        return res;
+    }
+
+
+
+    void RTR::scheduler::tally::reset()
+    {
+        tasks       = 0;
+        steals      = 0;
+        idle_waits  = 0;
+        idle_ns     = 0;
+    }
+
+
+
+    RTR::scheduler::tally_scope::tally_scope( tally& t)
+    : prev( tl_tally)
+    {
+        tl_tally = &t;
+    }
+
+
+
+    RTR::scheduler::tally_scope::~tally_scope()
+    {
+        tl_tally = prev;
+    }
+
+
+
+    void RTR::scheduler::reset_stats()
+    {
+        epoch_ns = now_ns();
+
+        for (auto& q : queues)
+        {
+            q->ran          = 0;
+            q->stolen       = 0;
+            q->idle_waits   = 0;
+            q->idle_ns      = 0;
+        }
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Task graph:
+//
+    RTR::task_graph::node_id RTR::task_graph::add( std::function<void()> fn)
+    {
+        nodes.push_back( std::make_unique<node>());
+        nodes.back()->fn = std::move( fn);
+        return nodes.size() - 1;
+    }
+
+
+
+    void RTR::task_graph::precede( node_id before, node_id after)
+    {
+        nodes[ before]->next.push_back( after);
+        nodes[ after]->deps++;
+    }
+
+
+
+    void RTR::task_graph::spawn( scheduler& s, scheduler::group& g, node_id id)
+    {
+        s.spawn( g, [this, &s, &g, id]
+        {
+            nodes[ id]->fn();
+
+            for (node_id n : nodes[ id]->next)
+                if (--nodes[ n]->pending == 0)
+                    spawn( s, g, n);
+        });
+    }
+
+
+
+    void RTR::task_graph::run( scheduler& s)
+    {
+        for (auto& n : nodes)
+            n->pending = n->deps;
+
+        scheduler::group g;
+        for (node_id id = 0; id < nodes.size(); id++)
+            if (nodes[ id]->deps == 0)
+                spawn( s, g, id);
+
+        s.wait( g);
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,237 @@
+#include "video.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <ios>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+
+namespace
+{
+    // Y = (77 R + 150 G + 29 B) / 256,
+    // U and V of the sums of a 2 x 2 block (hence / 1024)
+    uint8_t luma( uint32_t p)
+    {
+        int r = (p >> 16) & 0xff;
+        int g = (p >> 8)  & 0xff;
+        int b =  p        & 0xff;
+        return (77 * r + 150 * g + 29 * b + 128) >> 8;
+    }
+
+    uint8_t chroma( int sr, int sg, int sb, int cr, int cg, int cb)
+    {
+        int c = ((cr * sr + cg * sg + cb * sb + 512) >> 10) + 128;
+        return std::clamp( c, 0, 255);
+    }
+
+    const int U_R = -43, U_G = -85,  U_B = 128;
+    const int V_R = 128, V_G = -107, V_B = -21;
+
+
+#ifdef __SSE2__
+    // sums of the neighbouring 32 bit lanes of a, then of b
+    inline __m128i hadd_pairs( __m128i a, __m128i b)
+    {
+        __m128 fa = _mm_castsi128_ps( a);
+        __m128 fb = _mm_castsi128_ps( b);
+        return _mm_add_epi32(
+                    _mm_castps_si128( _mm_shuffle_ps( fa, fb, _MM_SHUFFLE( 2, 0, 2, 0))),
+                    _mm_castps_si128( _mm_shuffle_ps( fa, fb, _MM_SHUFFLE( 3, 1, 3, 1))));
+    }
+
+    // 8 pixels -> 8 lumas
+    inline void luma8( const uint32_t* src, uint8_t* dst)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i c    = _mm_set_epi16( 0, 77, 150, 29, 0, 77, 150, 29);
+        const __m128i half = _mm_set1_epi32( 128);
+
+        __m128i p[2] = { _mm_loadu_si128( reinterpret_cast<const __m128i*>( src)),
+                         _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + 4)) };
+        __m128i y[2];
+        for (int k = 0; k < 2; k++)
+        {
+            __m128i lo = _mm_madd_epi16( _mm_unpacklo_epi8( p[k], zero), c);
+            __m128i hi = _mm_madd_epi16( _mm_unpackhi_epi8( p[k], zero), c);
+            y[k] = _mm_srai_epi32( _mm_add_epi32( hadd_pairs( lo, hi), half), 8);
+        }
+
+        __m128i w = _mm_packs_epi32( y[0], y[1]);
+        _mm_storel_epi64( reinterpret_cast<__m128i*>( dst), _mm_packus_epi16( w, w));
+    }
+
+    // 8 x 2 pixels -> 4 U and 4 V
+    inline void chroma8( const uint32_t* row0, const uint32_t* row1,
+                         uint8_t* u, uint8_t* v)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i cu   = _mm_set_epi16( 0, U_R, U_G, U_B, 0, U_R, U_G, U_B);
+        const __m128i cv   = _mm_set_epi16( 0, V_R, V_G, V_B, 0, V_R, V_G, V_B);
+        const __m128i half = _mm_set1_epi32( 512);
+        const __m128i mid  = _mm_set1_epi32( 128);
+
+        __m128i s[2];
+        for (int k = 0; k < 2; k++)
+        {
+            __m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( row0 + 4 * k));
+            __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( row1 + 4 * k));
+
+            // (the columns of the pixels summed, then the pairs of them)
+            __m128i c01 = _mm_add_epi16( _mm_unpacklo_epi8( a, zero),
+                                         _mm_unpacklo_epi8( b, zero));
+            __m128i c23 = _mm_add_epi16( _mm_unpackhi_epi8( a, zero),
+                                         _mm_unpackhi_epi8( b, zero));
+            s[k] = _mm_add_epi16( _mm_unpacklo_epi64( c01, c23),
+                                  _mm_unpackhi_epi64( c01, c23));
+        }
+
+        auto convert = [&]( __m128i c, uint8_t* dst)
+        {
+            __m128i r = hadd_pairs( _mm_madd_epi16( s[0], c), _mm_madd_epi16( s[1], c));
+            r = _mm_add_epi32( _mm_srai_epi32( _mm_add_epi32( r, half), 10), mid);
+            r = _mm_packs_epi32( r, r);
+            int32_t bytes = _mm_cvtsi128_si32( _mm_packus_epi16( r, r));
+            std::memcpy( dst, &bytes, 4);
+        };
+        convert( cu, u);
+        convert( cv, v);
+    }
+#endif
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Constructor/Destructor:
+//
+    RTR::y4m_writer::y4m_writer( const std::string& path, int width, int height,
+                                 int fps)
+    : width( width), height( height)
+    {
+        if (path == "-")
+        {
+            // (the stream takes stdout, what is printed goes to stderr)
+            std::fflush( stdout);
+        #if defined(__unix__) || defined(__APPLE__)
+            int fd = dup( 1);
+            if ((fd >= 0) and (dup2( 2, 1) >= 0))
+            {
+                out   = fdopen( fd, "wb");
+                owned = true;
+            }
+        #else
+            out = stdout;
+        #endif
+        }
+        else
+        {
+            out   = std::fopen( path.c_str(), "wb");
+            owned = true;
+        }
+
+        if (out == nullptr)
+            throw std::ios_base::failure( "Can't open video output " + path);
+
+        std::setvbuf( out, nullptr, _IOFBF, 1 << 20);
+        std::fprintf( out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+                      width, height, fps);
+
+        size_t cw = (width + 1) / 2;
+        size_t ch = (height + 1) / 2;
+        planes.resize( size_t( width) * height + 2 * cw * ch);
+    }
+
+
+
+    RTR::y4m_writer::~y4m_writer()
+    {
+        if (owned)
+            std::fclose( out);
+        else
+            std::fflush( out);
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//  Frames:
+//
+    void RTR::y4m_writer::write( const uint32_t* pixels, int stride)
+    {
+        size_t cw = (width + 1) / 2;
+        size_t ch = (height + 1) / 2;
+        uint8_t* y = planes.data();
+        uint8_t* u = y + size_t( width) * height;
+        uint8_t* v = u + cw * ch;
+
+        rgb_to_yuv420( pixels, width, height, stride, y, u, v);
+
+        // (flushed so that a reader of a pipe gets the frame now)
+        if ((std::fputs( "FRAME\n", out) < 0) or
+            (std::fwrite( planes.data(), 1, planes.size(), out) != planes.size()) or
+            (std::fflush( out) != 0))
+            throw std::ios_base::failure( "Can't write a video frame");
+    }
+
+
+
+    void RTR::y4m_writer::rgb_to_yuv420( const uint32_t* pixels, int width,
+                                         int height, int stride, uint8_t* y,
+                                         uint8_t* u, uint8_t* v)
+    {
+        size_t cw = (width + 1) / 2;
+
+        for (int j = 0; j < height; j++)
+        {
+            const uint32_t* row = pixels + size_t( j) * stride;
+            uint8_t*        dst = y + size_t( j) * width;
+
+            int x = 0;
+        #ifdef __SSE2__
+            for (; x + 8 <= width; x += 8)
+                luma8( row + x, dst + x);
+        #endif
+            for (; x < width; x++)
+                dst[x] = luma( row[x]);
+        }
+
+        for (int j = 0; j < height; j += 2)
+        {
+            const uint32_t* row0 = pixels + size_t( j) * stride;
+            const uint32_t* row1 = (j + 1 < height) ? row0 + stride : row0;
+            uint8_t*        du   = u + size_t( j / 2) * cw;
+            uint8_t*        dv   = v + size_t( j / 2) * cw;
+
+            int x = 0;
+        #ifdef __SSE2__
+            for (; x + 8 <= width; x += 8)
+                chroma8( row0 + x, row1 + x, du + x / 2, dv + x / 2);
+        #endif
+            for (; x < width; x += 2)
+            {
+                int x1 = std::min( x + 1, width - 1);
+                int s[3] = {};
+                for (uint32_t p : { row0[x], row0[x1], row1[x], row1[x1]})
+                {
+                    s[0] += (p >> 16) & 0xff;
+                    s[1] += (p >> 8)  & 0xff;
+                    s[2] +=  p        & 0xff;
+                }
+                du[x / 2] = chroma( s[0], s[1], s[2], U_R, U_G, U_B);
+                dv[x / 2] = chroma( s[0], s[1], s[2], V_R, V_G, V_B);
+            }
+        }
+    }
+//
+//
+///////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,84 @@
+#include "frame_ring.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+
+
+namespace
+{
+    // a frame of the ring's largest size published and read back,
+    // false (and why on stderr) if it didn't come back as it went
+    bool round_trip( bool depths)
+    {
+        const int width  = 1000;
+        const int height = 800;
+        std::string name = "/rtr-test-" + std::to_string( getpid()) +
+                           (depths ? "-depths" : "-pixels");
+
+        std::vector<uint32_t> pixels( size_t( width) * height);
+        std::vector<int8_t>   zs( pixels.size());
+        for (size_t i = 0; i < pixels.size(); i++)
+        {
+            pixels[i] = uint32_t( i * 2654435761u) & 0xFFFFFF;
+            zs[i]     = int8_t( i % 251 - 125);
+        }
+
+        RTR::frame_ring ring( name, width, height, 2, depths);
+        RTR::frame_ring_reader reader( name);
+
+        bool same = false;
+        auto check = [&]( const RTR::frame_ring_slot& slot, const uint32_t* p,
+                          const int8_t* z)
+        {
+            same = (slot.width == uint32_t( width)) and (slot.height == uint32_t( height)) and
+                   ((z != nullptr) == depths) and
+                   (slot.depth_format == (depths ? RTR::FRAME_DEPTH_INT8 : RTR::FRAME_DEPTH_NONE));
+            for (int y = 0; same and (y < height); y++)
+                for (int x = 0; same and (x < width); x++)
+                {
+                    size_t i = size_t( y) * width + x;
+                    size_t j = size_t( y) * slot.stride + x;
+                    same = (p[j] == pixels[i]) and (!depths or (z[j] == zs[i]));
+                }
+        };
+
+        if (reader.read_latest( check))
+        {
+            std::cerr << name << ": read a frame before any was published" << std::endl;
+            return false;
+        }
+
+        // (twice: the second goes into the other slot)
+        for (int frame = 0; frame < 2; frame++)
+        {
+            ring.publish( pixels.data(), depths ? zs.data() : nullptr, width, height, width);
+            same = false;
+            if (!reader.read_latest( check) or !same)
+            {
+                std::cerr << name << ": frame " << frame << " didn't read back" << std::endl;
+                return false;
+            }
+        }
+
+        if (ring.dropped() != 0)
+        {
+            std::cerr << name << ": a frame that was read counted as dropped" << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+
+
+int main()
+{
+    bool ok = round_trip( false);
+    ok = round_trip( true) and ok;
+    return ok ? 0 : 1;
+}
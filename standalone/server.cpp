@@ -0,0 +1,99 @@
+#include "render_server.hpp"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+
+
+namespace
+{
+    const char* const usage_info =
+    "Usage: -s <SOCKET> [-j <THREADS>] [-k <RENDERS>] [-c <MiB>] [-q <REQUESTS>] [-t]\n";
+
+    RTR::render_server* running = nullptr;
+
+    void on_signal( int)
+    {
+        if (running)
+            running->stop();
+    }
+
+    [[noreturn]] void show_usage()
+    {
+        std::cout << usage_info;
+        std::exit( EXIT_FAILURE);
+    }
+}
+
+
+
+int main(int argc, char **argv)
+{
+    RTR::server_options options;
+    size_t n_threads = 0;   // std::thread::hardware_concurrency()
+
+    for (int i = 1; i < argc; i++)
+    {
+        if ((argv[i][0] != '-') or (argv[i][1] == 0) or (argv[i][2] != 0))
+            show_usage();
+
+        char opt = argv[i][1];
+        if (opt == 't')
+        {
+            options.verbose = true;
+            continue;
+        }
+
+        if ((i + 1 >= argc))
+            show_usage();
+        const char* arg = argv[++i];
+
+        switch (opt)
+        {
+            case 's' :  options.socket_path = arg;                  break;
+            case 'j' :  n_threads           = std::atoi( arg);      break;
+            case 'k' :  options.renders     = std::atoi( arg);      break;
+            case 'c' :  options.cache_bytes = size_t( std::atoi( arg)) << 20;
+                                                                    break;
+            case 'q' :  options.max_queue   = std::atoi( arg);      break;
+            default  :  show_usage();
+        }
+
+        if ((opt != 's') and (std::atoi( arg) <= 0))
+            show_usage();
+    }
+
+    if (options.socket_path.empty())
+        show_usage();
+
+    try
+    {
+        if (n_threads == 0)
+            n_threads = std::max( 1u, std::thread::hardware_concurrency());
+
+        RTR::scheduler      workers( n_threads);
+        RTR::render_server  server( options, workers);
+
+        running = &server;
+        std::signal( SIGINT,  on_signal);
+        std::signal( SIGTERM, on_signal);
+        std::signal( SIGPIPE, SIG_IGN);     // (a client that went away)
+
+        std::cout << "listening on " << options.socket_path << std::endl;
+        server.run();
+        running = nullptr;
+
+        std::cout << server.stats() << std::endl;
+    }
+
+    catch(std::exception& e)
+    {
+        std::cout<< "\nException catched in main:\t" << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}